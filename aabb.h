@@ -0,0 +1,71 @@
+#pragma once
+#ifndef __AABB__
+#define __AABB__
+
+#include "ray.h"
+#include <glm.hpp>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+
+// Slab distances are a few ulps off, so a ray through an edge or a corner can enter a box just
+// past a hit on its face. Box tests and traversal culls allow that much slack so the hit is found.
+const float kBoxSlack = 1.0f + 3.0f * std::numeric_limits<float>::epsilon();
+
+// Axis-aligned bounding box, shared by the scene BVH and the mesh BVHs
+class AABB
+{
+public:
+	AABB() : min(std::numeric_limits<float>::max()), max(-std::numeric_limits<float>::max()) {}
+	AABB(const glm::vec3& a, const glm::vec3& b) : min(a), max(b) {}
+
+	void grow(const glm::vec3& p) { min = glm::min(min, p); max = glm::max(max, p); }
+	void grow(const AABB& b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+	int longestAxis() const;
+	float area() const;
+
+	// slab test against [0, tMax], tEntry is the distance at which the ray enters the box
+	bool hit(const Ray& ray, const glm::vec3& invDir, float tMax, float& tEntry) const;
+
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+int AABB::longestAxis() const
+{
+	glm::vec3 e = max - min;
+	if (e.x > e.y && e.x > e.z)
+		return 0;
+	return e.y > e.z ? 1 : 2;
+}
+
+// surface area, the cost measure of the SAH builder; 0 for an empty box
+float AABB::area() const
+{
+	glm::vec3 e = glm::max(max - min, glm::vec3(0.0f));
+	return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+bool AABB::hit(const Ray& ray, const glm::vec3& invDir, float tMax, float& tEntry) const
+{
+	glm::vec3 t0 = (min - ray.origin) * invDir;
+	glm::vec3 t1 = (max - ray.origin) * invDir;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+
+	tEntry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+	return tEntry <= tExit * kBoxSlack;
+}
+
+// Work done by BVH and mesh queries, only collected when a TraversalStats is passed in
+struct TraversalStats
+{
+	TraversalStats() : nodes(0), primitives(0), steps(0) {}
+
+	uint64_t nodes; // boxes tested
+	uint64_t primitives; // spheres, other shapes and triangles tested
+	uint64_t steps; // nodes and leaves visited inside mesh BVHs
+};
+
+#endif // !__AABB__
@@ -0,0 +1,59 @@
+#pragma once
+#ifndef __ALIGNEDALLOCATOR__
+#define __ALIGNEDALLOCATOR__
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+// Allocator for std::vector storage that has to start on a SIMD or cache line boundary
+template <class T, size_t Alignment = 64>
+class AlignedAllocator
+{
+public:
+	typedef T value_type;
+
+	template <class U>
+	struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+	AlignedAllocator() {}
+	template <class U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+	T* allocate(size_t n)
+	{
+#ifdef _MSC_VER
+		void* p = _aligned_malloc(n * sizeof(T), Alignment);
+#else
+		void* p = nullptr;
+		if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0)
+			p = nullptr;
+#endif
+		if (!p)
+			throw std::bad_alloc();
+		return static_cast<T*>(p);
+	}
+
+	void deallocate(T* p, size_t)
+	{
+#ifdef _MSC_VER
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+
+	template <class U>
+	bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+	template <class U>
+	bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+template <class T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+#endif // !__ALIGNEDALLOCATOR__
@@ -0,0 +1,155 @@
+#pragma once
+#ifndef __BANDWRITER__
+#define __BANDWRITER__
+
+#include "tileScheduler.h"
+#include "stb_image_write.h"
+#include "toneMap.h"
+#include "pfm.h"
+#include <glm.hpp>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <string>
+#include <algorithm>
+
+// Streams the image to a JPEG file, and optionally to a float PFM file, while it is
+// rendered. Finished tiles are collected into bands of rows; a band is tone mapped and
+// encoded as soon as it and every band above it are complete, so only the bands still
+// being worked on are kept in memory.
+class BandWriter
+{
+public:
+	// bandHeight is rounded up to a multiple of 8, the JPEG block size
+	BandWriter(int width, int height, int bandHeight, const ToneMap& toneMap = ToneMap());
+	~BandWriter();
+
+	// hdrFile may be empty
+	bool open(const std::string& file, const std::string& hdrFile, int quality);
+	// thread safe; colors are the linear radiance of the tile, row by row
+	void write(const Tile& tile, const glm::vec3* colors);
+	// false if the file could not be written or rows are missing
+	bool close();
+
+	// largest number of bands held at the same time
+	size_t peakBands() const { return peak; }
+
+private:
+	struct Band
+	{
+		std::vector<glm::vec3> pixels;
+		int missing; // pixels not written yet
+	};
+
+	int rowsOf(int band) const { return std::min(bandHeight, height - band * bandHeight); }
+	Band& band(int index);
+	bool encode(int index, const std::vector<glm::vec3>& pixels);
+
+	int width, height, bandHeight;
+	ToneMap toneMap;
+	stbi_write_jpg_stream* stream;
+	PfmWriter hdr;
+	bool writeHdr;
+	std::vector<unsigned char> quantised; // only used by the encoding worker
+
+	std::mutex mutex;
+	std::map<int, Band> bands;
+	int nextBand; // first band not encoded yet
+	bool encoding; // a worker is passing bands to the encoder
+	bool failed;
+	size_t peak;
+};
+
+BandWriter::BandWriter(int width, int height, int bandHeight, const ToneMap& toneMap)
+	: width(width), height(height), bandHeight((std::max(1, bandHeight) + 7) / 8 * 8), toneMap(toneMap),
+	stream(nullptr), writeHdr(false), nextBand(0), encoding(false), failed(false), peak(0)
+{
+}
+
+BandWriter::~BandWriter()
+{
+	if (stream)
+		stbi_write_jpg_end(stream);
+}
+
+bool BandWriter::open(const std::string& file, const std::string& hdrFile, int quality)
+{
+	writeHdr = !hdrFile.empty();
+	if (writeHdr && !hdr.open(hdrFile, width, height))
+		return false;
+	stream = stbi_write_jpg_begin(file.c_str(), width, height, 3, quality);
+	return stream != nullptr;
+}
+
+bool BandWriter::encode(int index, const std::vector<glm::vec3>& pixels)
+{
+	int rows = rowsOf(index);
+	if (writeHdr && !hdr.writeRows(index * bandHeight, rows, pixels.data()))
+		return false;
+
+	quantised.resize(3 * pixels.size());
+	for (size_t i = 0; i < pixels.size(); i++)
+		toneMap.quantise(pixels[i], &quantised[3 * i]);
+	return stream && stbi_write_jpg_rows(stream, quantised.data(), rows);
+}
+
+BandWriter::Band& BandWriter::band(int index)
+{
+	auto it = bands.find(index);
+	if (it != bands.end())
+		return it->second;
+
+	Band& b = bands[index];
+	b.pixels.resize(width * rowsOf(index));
+	b.missing = width * rowsOf(index);
+	peak = std::max(peak, bands.size());
+	return b;
+}
+
+void BandWriter::write(const Tile& tile, const glm::vec3* colors)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	int tileWidth = tile.x1 - tile.x0;
+	for (int j = tile.y0; j < tile.y1; j++)
+	{
+		Band& b = band(j / bandHeight);
+		std::copy(colors + (j - tile.y0) * tileWidth, colors + (j - tile.y0 + 1) * tileWidth,
+			b.pixels.begin() + width * (j % bandHeight) + tile.x0);
+		b.missing -= tileWidth;
+	}
+
+	// one worker at a time encodes, the others keep rendering
+	if (encoding)
+		return;
+	encoding = true;
+	for (;;)
+	{
+		auto it = bands.find(nextBand);
+		if (it == bands.end() || it->second.missing > 0)
+			break;
+
+		std::vector<glm::vec3> pixels;
+		pixels.swap(it->second.pixels);
+		lock.unlock();
+		bool written = encode(nextBand, pixels);
+		lock.lock();
+
+		failed = failed || !written;
+		bands.erase(nextBand);
+		nextBand++;
+	}
+	encoding = false;
+}
+
+bool BandWriter::close()
+{
+	if (!stream)
+		return false;
+	bool complete = stbi_write_jpg_end(stream) != 0;
+	stream = nullptr;
+	bool hdrClosed = hdr.close();
+	return complete && hdrClosed && !failed;
+}
+
+#endif // !__BANDWRITER__
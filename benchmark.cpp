@@ -0,0 +1,421 @@
+#include <glm.hpp>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stbi_image.h"
+#include "tracer.h"
+#include "sceneLoader.h"
+#include "tileScheduler.h"
+#include "mesh.h"
+#include "objLoader.h"
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <atomic>
+#include <cstring>
+#include <cstdlib>
+
+// Timings of the ray tracing kernels, of the sphere intersection structures for growing
+// scenes, of triangle mesh loading and traversal, and of whole frames of the demo scene. All ray sets come from fixed seeds, so runs
+// are comparable across versions. --csv prints one line per measurement:
+//   suite,name,parameter,ns_per_op,mrays_per_s
+// Run it from the directory with the demo scene textures.
+
+static bool csv = false;
+
+static void report(const char* suite, const std::string& name, long long parameter, double nsPerOp, bool rays)
+{
+    double mrays = rays ? 1000.0 / nsPerOp : 0.0;
+    if (csv)
+    {
+        std::cout << suite << ',' << name << ',' << parameter << ',' << std::fixed << std::setprecision(3)
+            << nsPerOp << ',' << mrays << std::endl;
+        return;
+    }
+    std::cout << std::left << std::setw(12) << suite << std::setw(22) << name << std::right << std::setw(10) << parameter
+        << std::fixed << std::setprecision(1) << std::setw(14) << nsPerOp;
+    if (rays)
+        std::cout << std::setprecision(2) << std::setw(12) << mrays;
+    std::cout << std::endl;
+}
+
+// best of three runs of op(0) .. op(count - 1). The results of op are summed and stored, so the
+// work cannot be optimised away; total receives the sum when given.
+template <class F>
+static double nsPerOp(int count, F&& op, double* total = nullptr)
+{
+    static volatile double sink;
+    double best = std::numeric_limits<double>::max();
+    for (int run = 0; run < 3; run++)
+    {
+        double acc = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; i++)
+            acc += op(i);
+        auto end = std::chrono::steady_clock::now();
+        sink = acc;
+        if (total)
+            *total = acc;
+        best = std::min(best, std::chrono::duration<double, std::nano>(end - start).count() / count);
+    }
+    return best;
+}
+
+static Scene randomScene(int count, std::mt19937& rng)
+{
+    float extent = 10.0f * std::cbrt(float(count));
+    std::uniform_real_distribution<float> position(-extent, extent);
+    std::uniform_real_distribution<float> radius(0.5f, 1.5f);
+
+    Scene scene;
+    Material material;
+    for (int i = 0; i < count; i++)
+        scene.spheres.push_back(Sphere(glm::vec3(position(rng), position(rng), position(rng)), radius(rng), material));
+    scene.build();
+    return scene;
+}
+
+static std::vector<Ray> randomRays(int count, float extent, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> position(-extent, extent);
+    std::normal_distribution<float> direction;
+
+    std::vector<Ray> rays;
+    for (int i = 0; i < count; i++)
+        rays.push_back(Ray(glm::vec3(position(rng), position(rng), position(rng)),
+            glm::normalize(glm::vec3(direction(rng), direction(rng), direction(rng)))));
+    return rays;
+}
+
+// Coherent rays one by one and as packets, per ray: camera rays in scanline order, and the
+// five jittered shadow rays towards the point light from every hit
+static void packets(const Scene& scene)
+{
+    RenderSettings settings;
+    settings.width = 400;
+    settings.height = 200;
+
+    std::vector<Ray> camera;
+    for (int j = 0; j < settings.height; j++)
+        for (int i = 0; i < settings.width; i++)
+            camera.push_back(CameraRay(settings, i, j));
+    int count = int(camera.size());
+
+    std::vector<Ray> shadow;
+    std::vector<float> lengths;
+    const Light& light = scene.pointLights[0];
+    for (auto& ray : camera)
+    {
+        HitRecord hit;
+        if (!SceneIntersect(ray, scene, hit))
+            continue;
+        glm::vec3 origin = hit.point + hit.normal * 1e-3f;
+        glm::vec3 toLight = glm::normalize(light.position - hit.point);
+        for (float offset : { 0.0f, 0.01f, -0.01f, 0.02f, -0.02f, 0.0f, 0.0f, 0.0f })
+        {
+            shadow.push_back(Ray(origin, glm::normalize(toLight + glm::vec3(offset))));
+            lengths.push_back(glm::length(light.position - hit.point));
+        }
+    }
+    int shadowCount = int(shadow.size());
+
+    report("packet", "camera_single", 1, nsPerOp(count, [&](int i)
+        {
+            float t = kInfinity;
+            int index = -1, triangle = -1;
+            return scene.bvh.closestHit(camera[i], scene.sphereStore, scene.shapeStore, t, index, triangle) ? t : 0.0f;
+        }), true);
+    report("packet", "shadow_single", 1, nsPerOp(shadowCount, [&](int i)
+        {
+            return scene.bvh.occluded(shadow[i], scene.sphereStore, scene.shapeStore, lengths[i]) ? 1.0f : 0.0f;
+        }), true);
+
+    static const char* names[] = { "camera_scalar", "camera_simd", "shadow_scalar", "shadow_simd" };
+    for (int size : { 4, 8, 16 })
+        for (int k = 0; k < 4; k++)
+        {
+            PacketKernels kernels = selectPacketKernels(k % 2 == 1);
+            bool shadowRays = k >= 2;
+            const std::vector<Ray>& rays = shadowRays ? shadow : camera;
+            double ns = nsPerOp(int(rays.size()) / size, [&](int i)
+                {
+                    RayPacket packet;
+                    for (int r = i * size; r < (i + 1) * size; r++)
+                        packet.add(rays[r], shadowRays ? lengths[r] : kInfinity);
+                    packet.finish();
+                    if (shadowRays)
+                        return float(PacketOccluded(scene.bvh, scene.sphereStore, scene.shapeStore, packet, nullptr, kernels));
+                    int index[kMaxPacketSize], triangle[kMaxPacketSize];
+                    PacketClosestHit(scene.bvh, scene.sphereStore, scene.shapeStore, packet, index, triangle, nullptr, kernels);
+                    return packet.tMax[0];
+                });
+            report("packet", names[k], size, ns / size, true);
+        }
+}
+
+// Kernels on the demo scene: camera rays through random points of a 400x200 image
+static void kernels(const Scene& scene, std::mt19937& rng)
+{
+    const int count = 100000;
+    RenderSettings settings;
+    settings.width = 400;
+    settings.height = 200;
+
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<Ray> rays;
+    for (int i = 0; i < count; i++)
+        rays.push_back(CameraRay(settings, size_t(unit(rng) * settings.width), size_t(unit(rng) * settings.height),
+            unit(rng), unit(rng)));
+
+    int spheres = int(scene.spheres.size());
+    report("kernel", "sphere_hit", spheres, nsPerOp(count, [&](int i)
+        {
+            float dist;
+            return scene.spheres[i % spheres].hit(rays[i], dist) ? dist : 0.0f;
+        }), true);
+
+    RayCone cone(0.0f, settings.pixelAngle());
+    std::vector<HitRecord> hits;
+    for (auto& ray : rays)
+    {
+        HitRecord hit;
+        if (SceneIntersect(ray, scene, hit, cone, settings.textureFilter))
+            hits.push_back(hit);
+    }
+
+    report("kernel", "scene_intersect", count, nsPerOp(count, [&](int i)
+        {
+            HitRecord hit;
+            return SceneIntersect(rays[i], scene, hit, cone, settings.textureFilter) ? hit.t : 0.0f;
+        }), true);
+
+    int hitCount = int(hits.size());
+    const Light& light = scene.pointLights[0];
+    report("kernel", "occluded", hitCount, nsPerOp(hitCount, [&](int i)
+        {
+            const HitRecord& hit = hits[i];
+            glm::vec3 toLight = light.position - hit.point;
+            float dist = glm::length(toLight);
+            return Occluded(Ray(hit.point + hit.normal * 1e-3f, toLight / dist), scene, dist) ? 1.0f : 0.0f;
+        }), true);
+
+    report("kernel", "lighting", hitCount, nsPerOp(hitCount, [&](int i)
+        {
+            const HitRecord& hit = hits[i];
+            Sampler sampler(i, 0);
+            float diffuse = 0, specular = 0, back = 0;
+            Lighting(scene, settings, hit.normal, hit.point, -rays[i].direction, hit.material->specularExponent,
+                diffuse, specular, back, sampler);
+            return diffuse + specular + back;
+        }), false);
+
+    std::vector<glm::vec3> directions;
+    std::vector<glm::vec2> uvs;
+    std::normal_distribution<float> normal;
+    for (int i = 0; i < count; i++)
+    {
+        directions.push_back(glm::normalize(glm::vec3(normal(rng), normal(rng), normal(rng))));
+        uvs.push_back(glm::vec2(unit(rng), unit(rng)));
+    }
+
+    report("kernel", "texture_coordinates", count, nsPerOp(count, [&](int i)
+        {
+            float u, v;
+            getSphereTextureCoordinats(directions[i], u, v);
+            return u + v;
+        }), false);
+
+    const Image& texture = scene.textures[0];
+    report("kernel", "image_nearest", texture.nx, nsPerOp(count, [&](int i)
+        {
+            return texture.value(uvs[i].x, uvs[i].y).r;
+        }), false);
+
+    // footprints between one and 64 texels
+    report("kernel", "image_trilinear", texture.nx, nsPerOp(count, [&](int i)
+        {
+            float du = std::exp2(6.0f * uvs[(i + 1) % count].x) / texture.nx;
+            return texture.sample(uvs[i].x, uvs[i].y, du, du, TextureFilter::Trilinear).r;
+        }), false);
+}
+
+// Closest hit cost of the linear sphere loop, the sphere store kernels and the BVH.
+// Sphere density is kept constant, so only the number of spheres changes.
+static void scaling(std::mt19937& rng)
+{
+    const int count = 50000;
+    for (int spheres = 16; spheres <= 16384; spheres *= 4)
+    {
+        Scene scene = randomScene(spheres, rng);
+        std::vector<Ray> rays = randomRays(count, 10.0f * std::cbrt(float(spheres)), rng);
+        SphereKernel simdKernel = selectSphereKernel();
+
+        double linearHits, hits[4];
+        report("scaling", "linear", spheres, nsPerOp(count, [&](int i)
+            {
+                float best = std::numeric_limits<float>::max();
+                for (auto& sphere : scene.spheres)
+                {
+                    float dist;
+                    if (sphere.hit(rays[i], dist) && dist < best)
+                        best = dist;
+                }
+                return best < std::numeric_limits<float>::max() ? 1.0f : 0.0f;
+            }, &linearHits), true);
+
+        // scalar and SIMD kernel over the whole store, then the same pair through the BVH
+        static const char* names[] = { "store_scalar", "store_simd", "bvh_scalar", "bvh_simd" };
+        for (int k = 0; k < 4; k++)
+        {
+            scene.sphereStore.kernel = k % 2 == 0 ? intersectSpheresScalar : simdKernel;
+            report("scaling", names[k], spheres, nsPerOp(count, [&](int i)
+                {
+                    float dist = std::numeric_limits<float>::max();
+                    int index = -1, triangle = -1;
+                    if (k < 2)
+                        return scene.sphereStore.intersect(0, scene.sphereStore.size(), rays[i], dist, index) ? 1.0f : 0.0f;
+                    return scene.bvh.closestHit(rays[i], scene.sphereStore, scene.shapeStore, dist, index, triangle) ? 1.0f : 0.0f;
+                }, &hits[k]), true);
+        }
+        for (int k = 0; k < 4; k++)
+            if (hits[k] != linearHits)
+                std::cerr << "scaling " << names[k] << " " << spheres << ": hit count mismatch" << std::endl;
+    }
+}
+
+// A rippled grid of two million triangles: OBJ parsing and BVH build per triangle, on one and on
+// all hardware threads, and closest hits of rays shot down at it. The OBJ file is written to the
+// working directory and removed afterwards.
+static void meshes(std::mt19937& rng)
+{
+    const int n = 1000;
+    const char* file = "benchmark_mesh.obj";
+    {
+        std::ofstream out(file);
+        for (int i = 0; i <= n; i++)
+            for (int j = 0; j <= n; j++)
+                out << "v " << i * 0.01f << ' ' << 0.1f * std::sin(i * 0.05f) * std::cos(j * 0.07f) << ' ' << j * 0.01f << '\n';
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < n; j++)
+            {
+                int a = i * (n + 1) + j + 1;
+                out << "f " << a << ' ' << a + n + 1 << ' ' << a + n + 2 << ' ' << a + 1 << '\n';
+            }
+    }
+
+    TriangleMesh mesh;
+    std::string error;
+    int triangles = 2 * n * n;
+    for (int threads : { 1, 0 })
+        report("mesh", threads == 1 ? "obj_parse_1t" : "obj_parse_all", triangles, nsPerOp(1, [&](int)
+            {
+                return LoadObj(file, mesh, error, threads) ? float(mesh.triangleCount()) : 0.0f;
+            }) / triangles, false);
+    std::remove(file);
+    if (mesh.indices.empty())
+    {
+        std::cerr << error << std::endl;
+        return;
+    }
+
+    // building again from the leaf order of the last build gives the same tree
+    for (int threads : { 1, 0 })
+        report("mesh", threads == 1 ? "build_1t" : "build_all", triangles, nsPerOp(1, [&](int)
+            {
+                mesh.build(threads);
+                return float(mesh.nodes.size());
+            }) / triangles, false);
+
+    const int count = 100000;
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<Ray> rays;
+    for (int i = 0; i < count; i++)
+        rays.push_back(Ray(glm::vec3(10.0f * unit(rng), 5.0f, 10.0f * unit(rng)),
+            glm::normalize(glm::vec3(unit(rng) - 0.5f, -1.0f, unit(rng) - 0.5f))));
+    // the same rays through the full and the quantised four-wide nodes
+    for (bool compressed : { false, true })
+    {
+        if (compressed)
+            mesh.compress();
+        report("mesh", compressed ? "closest_hit_compressed" : "closest_hit", triangles, nsPerOp(count, [&](int i)
+            {
+                float t;
+                int triangle;
+                return mesh.closestHit(rays[i], kInfinity, t, triangle) ? t : 0.0f;
+            }), true);
+    }
+}
+
+// Whole glossy frames of the demo scene without output. Rays are the traced segments of the
+// reflection trees, shadow rays are not counted.
+static void frames(const Scene& scene, int threads)
+{
+    static const int sizes[][2] = { { 200, 100 }, { 400, 200 }, { 800, 400 } };
+    for (auto& size : sizes)
+    {
+        RenderSettings settings;
+        settings.width = size[0];
+        settings.height = size[1];
+        settings.threads = threads;
+
+        TileScheduler scheduler(settings.width, settings.height, settings.tileSize, settings.threads);
+        std::vector<TraceContext> contexts(scheduler.threads());
+        std::atomic<long long> rays(0);
+
+        auto start = std::chrono::steady_clock::now();
+        scheduler.run([&](const Tile& tile, int worker)
+            {
+                std::vector<Ray> primary;
+                std::vector<glm::vec3> colors((tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+                for (int j = tile.y0; j < tile.y1; j++)
+                    for (int i = tile.x0; i < tile.x1; i++)
+                        primary.push_back(CameraRay(settings, i, j));
+                TraceBatch(scene, settings, primary, colors.data(), contexts[worker]);
+                rays += contexts[worker].segments.size();
+            });
+        auto end = std::chrono::steady_clock::now();
+
+        double ns = std::chrono::duration<double, std::nano>(end - start).count();
+        report("frame", "glossy_" + std::to_string(settings.width) + "x" + std::to_string(settings.height),
+            rays, ns / double(rays), true);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int threads = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--csv"))
+            csv = true;
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else
+        {
+            std::cerr << "usage: benchmark [--csv] [--threads N]" << std::endl;
+            return 1;
+        }
+    }
+
+    Scene scene;
+    buildDefaultScene(scene);
+    if (scene.textures.size() != 6)
+    {
+        std::cerr << "cannot load the demo scene textures" << std::endl;
+        return 1;
+    }
+
+    if (csv)
+        std::cout << "suite,name,parameter,ns_per_op,mrays_per_s" << std::endl;
+    else
+        std::cout << std::left << std::setw(12) << "suite" << std::setw(22) << "name" << std::right << std::setw(10)
+            << "param" << std::setw(14) << "ns/op" << std::setw(12) << "Mrays/s" << std::endl;
+
+    std::mt19937 rng(12345);
+    kernels(scene, rng);
+    packets(scene);
+    scaling(rng);
+    meshes(rng);
+    frames(scene, threads);
+}
@@ -0,0 +1,269 @@
+#pragma once
+#ifndef __BVH__
+#define __BVH__
+
+#include "ray.h"
+#include "aabb.h"
+#include "geometricObjects.h"
+#include "sphereSoA.h"
+#include "shapeStore.h"
+#include <glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+
+struct BVHNode
+{
+	AABB bounds;
+	int first; // first child for inner nodes, entry of BVH::leaves for leaves
+	int count; // primitives of a leaf, 0 for inner nodes
+};
+
+// Bounding volume hierarchy over all scene objects. Children of a node are stored next to
+// each other. The objects of a leaf are grouped by type, and every type's store is built
+// in BVH::indices order, so a leaf is one contiguous run of slots per type (BVH::leaves):
+// spheres go through the SIMD sphere kernels, the other shapes through their own loops.
+class BVH
+{
+public:
+	// boxes and centers per scene object number, kinds tell the type of each
+	void build(const std::vector<AABB>& boxes, const std::vector<glm::vec3>& centers, const std::vector<ShapeKind>& kinds);
+	// primitive receives the triangle of a mesh or instance hit, see ShapeStore::intersect
+	bool closestHit(const Ray& ray, const SphereSoA& spheres, const ShapeStore& shapes, float& tHit, int& index,
+		int& primitive, TraversalStats* stats = nullptr) const;
+	// any-hit query for shadow rays, stops at the first shadow casting object closer than maxDist;
+	// occluder receives the leaf node that blocked the ray
+	bool occluded(const Ray& ray, const SphereSoA& spheres, const ShapeStore& shapes, float maxDist,
+		TraversalStats* stats = nullptr, int* occluder = nullptr) const;
+	// the same query against the objects of one leaf node only, without its box
+	bool occludedInLeaf(int node, const Ray& ray, const SphereSoA& spheres, const ShapeStore& shapes, float maxDist,
+		TraversalStats* stats = nullptr) const;
+
+	std::vector<BVHNode> nodes;
+	std::vector<ShapeRange> leaves;
+	std::vector<int> indices; // object numbers in leaf order
+
+	static const int maxLeafSize;
+
+private:
+	void split(int node, const std::vector<AABB>& boxes, const std::vector<glm::vec3>& centers);
+};
+
+const int BVH::maxLeafSize = 8;
+
+void BVH::build(const std::vector<AABB>& boxes, const std::vector<glm::vec3>& centers, const std::vector<ShapeKind>& kinds)
+{
+	nodes.clear();
+	leaves.clear();
+	indices.clear();
+	if (boxes.empty())
+		return;
+
+	for (int i = 0; i < int(boxes.size()); i++)
+		indices.push_back(i);
+	nodes.reserve(2 * boxes.size());
+	nodes.push_back({ AABB(), 0, int(boxes.size()) });
+	split(0, boxes, centers);
+
+	// group every leaf by type; leaves are visited in index order so the slots of each
+	// type count up through the leaves
+	std::vector<int> leafNodes;
+	for (int n = 0; n < int(nodes.size()); n++)
+		if (nodes[n].count > 0)
+			leafNodes.push_back(n);
+	std::sort(leafNodes.begin(), leafNodes.end(), [&](int a, int b) { return nodes[a].first < nodes[b].first; });
+
+	int next[kShapeKinds] = {};
+	for (int n : leafNodes)
+	{
+		BVHNode& node = nodes[n];
+		std::stable_sort(indices.begin() + node.first, indices.begin() + node.first + node.count,
+			[&](int a, int b) { return kinds[a] < kinds[b]; });
+
+		ShapeRange range;
+		for (int k = 0; k < kShapeKinds; k++)
+		{
+			range.first[k] = next[k];
+			range.count[k] = 0;
+		}
+		for (int i = node.first; i < node.first + node.count; i++)
+			range.count[int(kinds[indices[i]])]++;
+		for (int k = 0; k < kShapeKinds; k++)
+			next[k] += range.count[k];
+
+		node.first = int(leaves.size());
+		leaves.push_back(range);
+	}
+}
+
+void BVH::split(int node, const std::vector<AABB>& boxes, const std::vector<glm::vec3>& centers)
+{
+	int first = nodes[node].first;
+	int count = nodes[node].count;
+
+	AABB bounds, centroidBounds;
+	for (int i = first; i < first + count; i++)
+	{
+		bounds.grow(boxes[indices[i]]);
+		centroidBounds.grow(centers[indices[i]]);
+	}
+	nodes[node].bounds = bounds;
+
+	if (count <= maxLeafSize)
+		return;
+
+	// median split along the longest axis of the centroid bounds
+	int axis = centroidBounds.longestAxis();
+	int mid = first + count / 2;
+	std::nth_element(indices.begin() + first, indices.begin() + mid, indices.begin() + first + count,
+		[&](int a, int b) { return centers[a][axis] < centers[b][axis]; });
+
+	int left = int(nodes.size());
+	nodes.push_back({ AABB(), first, mid - first });
+	nodes.push_back({ AABB(), mid, first + count - mid });
+	nodes[node].first = left;
+	nodes[node].count = 0;
+
+	split(left, boxes, centers);
+	split(left + 1, boxes, centers);
+}
+
+bool BVH::closestHit(const Ray& ray, const SphereSoA& spheres, const ShapeStore& shapes, float& tHit, int& index,
+	int& primitive, TraversalStats* stats) const
+{
+	if (nodes.empty())
+		return false;
+
+	glm::vec3 invDir = 1.0f / ray.direction;
+	float best = std::numeric_limits<float>::max();
+	int bestIndex = -1;
+	int boxTests = 1, primitiveTests = 0;
+
+	struct Entry { int node; float t; };
+	Entry stack[64];
+	int top = 0;
+
+	float t;
+	if (!nodes[0].bounds.hit(ray, invDir, best, t))
+	{
+		if (stats)
+			stats->nodes++;
+		return false;
+	}
+	stack[top++] = { 0, t };
+
+	while (top > 0)
+	{
+		Entry entry = stack[--top];
+		if (entry.t > best)
+			continue;
+
+		const BVHNode& node = nodes[entry.node];
+		if (node.count > 0)
+		{
+			const ShapeRange& leaf = leaves[node.first];
+			int sphereCount = leaf.count[int(ShapeKind::Sphere)];
+			if (sphereCount)
+				spheres.intersect(leaf.first[0], leaf.first[0] + sphereCount, ray, best, bestIndex);
+			if (node.count > sphereCount)
+				shapes.intersect(leaf, ray, best, bestIndex, primitive, stats);
+			primitiveTests += node.count;
+			continue;
+		}
+
+		boxTests += 2;
+		float tLeft, tRight;
+		bool hitLeft = nodes[node.first].bounds.hit(ray, invDir, best, tLeft);
+		bool hitRight = nodes[node.first + 1].bounds.hit(ray, invDir, best, tRight);
+
+		// push the far child first so the near one is visited first
+		if (hitLeft && hitRight)
+		{
+			if (tLeft < tRight)
+			{
+				stack[top++] = { node.first + 1, tRight };
+				stack[top++] = { node.first, tLeft };
+			}
+			else
+			{
+				stack[top++] = { node.first, tLeft };
+				stack[top++] = { node.first + 1, tRight };
+			}
+		}
+		else if (hitLeft)
+			stack[top++] = { node.first, tLeft };
+		else if (hitRight)
+			stack[top++] = { node.first + 1, tRight };
+	}
+
+	if (stats)
+	{
+		stats->nodes += boxTests;
+		stats->primitives += primitiveTests;
+	}
+	if (bestIndex < 0)
+		return false;
+
+	tHit = best;
+	index = bestIndex;
+	return true;
+}
+
+bool BVH::occludedInLeaf(int node, const Ray& ray, const SphereSoA& spheres, const ShapeStore& shapes, float maxDist,
+	TraversalStats* stats) const
+{
+	const ShapeRange& leaf = leaves[nodes[node].first];
+	int sphereCount = leaf.count[int(ShapeKind::Sphere)];
+	return (sphereCount && spheres.occluded(leaf.first[0], leaf.first[0] + sphereCount, ray, maxDist)) ||
+		(nodes[node].count > sphereCount && shapes.occluded(leaf, ray, maxDist, stats));
+}
+
+bool BVH::occluded(const Ray& ray, const SphereSoA& spheres, const ShapeStore& shapes, float maxDist,
+	TraversalStats* stats, int* occluder) const
+{
+	if (nodes.empty())
+		return false;
+
+	glm::vec3 invDir = 1.0f / ray.direction;
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	int boxTests = 0, primitiveTests = 0;
+	bool blocked = false;
+
+	while (top > 0)
+	{
+		int index = stack[--top];
+		const BVHNode& node = nodes[index];
+		float t;
+		boxTests++;
+		if (!node.bounds.hit(ray, invDir, maxDist, t))
+			continue;
+
+		if (node.count > 0)
+		{
+			primitiveTests += node.count;
+			if (occludedInLeaf(index, ray, spheres, shapes, maxDist, stats))
+			{
+				blocked = true;
+				if (occluder)
+					*occluder = index;
+				break;
+			}
+			continue;
+		}
+
+		stack[top++] = node.first + 1;
+		stack[top++] = node.first;
+	}
+
+	if (stats)
+	{
+		stats->nodes += boxTests;
+		stats->primitives += primitiveTests;
+	}
+	return blocked;
+}
+
+#endif // !__BVH__
@@ -0,0 +1,295 @@
+#pragma once
+#ifndef __GBUFFER__
+#define __GBUFFER__
+
+#include "tracer.h"
+#include "scene.h"
+#include "settings.h"
+#include "hit.h"
+#include <glm.hpp>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+
+// What the primary ray of a pixel hit, and the pixel's radiance from the frame that wrote it
+struct GBufferSample
+{
+	glm::vec3 point;
+	glm::vec3 normal; // shading normal, after the normal map
+	glm::vec2 uv;
+	glm::vec2 footprint;
+	float t; // kInfinity when the primary ray missed
+	int object; // scene object number, the material id
+	uint64_t objects; // ObjectBit of everything the pixel's rays hit, reflections included
+	glm::vec3 radiance;
+};
+
+// FNV-1a over the bytes of scene and settings values
+struct SceneHash
+{
+	SceneHash() : value(0xcbf29ce484222325ULL) {}
+
+	void add(const void* data, size_t size)
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; i++)
+			value = (value ^ bytes[i]) * 0x100000001b3ULL;
+	}
+	template <class T> void add(const T& v) { add(&v, sizeof(v)); }
+	template <class T> void add(const std::vector<T>& v) { add(v.data(), v.size() * sizeof(T)); add(v.size()); }
+	void add(const std::string& s) { add(s.data(), s.size()); add(s.size()); }
+
+	uint64_t value;
+};
+
+// Per-pixel primary hits kept between renders. As long as nothing that camera visibility
+// depends on changes (resolution, field of view, scene geometry, normal maps), a later
+// render reuses the hits instead of tracing primary rays, and only pixels whose rays hit
+// an object with a changed material are shaded again. A change of the lights or of the
+// shading settings shades every pixel that hit something.
+// The file is a raw dump, it is only meant to be read back on the machine that wrote it.
+class GBuffer
+{
+public:
+	GBuffer() : width(0), height(0), visibilityKey(0), shadingKey(0) {}
+
+	// empty buffer for the scene, every pixel has to be traced
+	void reset(const Scene& scene, const RenderSettings& settings);
+	// takes the shading and material keys of the scene, once the changed pixels are shaded again
+	void updateKeys(const Scene& scene, const RenderSettings& settings);
+	// false if the file is missing, unreadable or was written for a different visibility
+	bool load(const std::string& file, const Scene& scene, const RenderSettings& settings);
+	bool save(const std::string& file) const;
+
+	// ObjectBit mask of the objects whose shading changed since the buffer was written; all
+	// bits when the lights or the shading settings changed
+	uint64_t changedObjects(const Scene& scene, const RenderSettings& settings) const;
+	// rebuilds the hit of a pixel from its sample
+	HitRecord hit(int i, int j, const Scene& scene, TextureFilter filter) const;
+	void store(int i, int j, const HitRecord& hit, uint64_t objects, const glm::vec3& radiance);
+
+	GBufferSample& at(int i, int j) { return samples[size_t(j) * width + i]; }
+	const GBufferSample& at(int i, int j) const { return samples[size_t(j) * width + i]; }
+
+	static uint64_t VisibilityKey(const Scene& scene, const RenderSettings& settings);
+	static uint64_t ShadingKey(const Scene& scene, const RenderSettings& settings);
+	static uint64_t MaterialKey(const Scene& scene, const Material& material);
+	static uint64_t MeshKey(const TriangleMesh& mesh);
+
+private:
+	int width, height;
+	uint64_t visibilityKey, shadingKey;
+	std::vector<uint64_t> materialKeys; // one per scene object
+	std::vector<GBufferSample> samples;
+};
+
+static const char kGBufferMagic[4] = { 'R', 'T', 'G', '2' };
+
+uint64_t GBuffer::VisibilityKey(const Scene& scene, const RenderSettings& settings)
+{
+	SceneHash h;
+	h.add(settings.width);
+	h.add(settings.height);
+	h.add(settings.fov);
+	h.add(settings.textureFilter); // normal map lookups
+	h.add(scene.spheres.size());
+	for (auto& sphere : scene.spheres)
+	{
+		h.add(sphere.center);
+		h.add(sphere.radius);
+		h.add(sphere.type);
+		h.add(sphere.material.isBump);
+		if (sphere.material.isBump)
+			h.add(scene.textures.file(sphere.material.normalMap));
+	}
+	h.add(scene.planes.size());
+	for (auto& plane : scene.planes)
+	{
+		h.add(plane.point);
+		h.add(plane.normal);
+		h.add(plane.boundsMin);
+		h.add(plane.boundsMax);
+	}
+	h.add(scene.boxes.size());
+	for (auto& box : scene.boxes)
+	{
+		h.add(box.min);
+		h.add(box.max);
+	}
+	h.add(scene.discs.size());
+	for (auto& disc : scene.discs)
+	{
+		h.add(disc.center);
+		h.add(disc.normal);
+		h.add(disc.radius);
+	}
+	// a mesh shared by many objects is hashed once
+	std::map<const TriangleMesh*, uint64_t> meshKeys;
+	auto meshKey = [&](const TriangleMesh* mesh)
+	{
+		auto it = meshKeys.find(mesh);
+		if (it == meshKeys.end())
+			it = meshKeys.emplace(mesh, MeshKey(*mesh)).first;
+		return it->second;
+	};
+	h.add(scene.meshes.size());
+	for (auto& mesh : scene.meshes)
+		h.add(meshKey(mesh.geometry.get()));
+	h.add(scene.instances.size());
+	for (auto& instance : scene.instances)
+	{
+		h.add(instance.mesh ? meshKey(instance.mesh.get()) : uint64_t(0));
+		h.add(instance.linear);
+		h.add(instance.translation);
+		const Material& material = scene.materials[instance.material];
+		h.add(material.isBump);
+		if (material.isBump && !instance.mesh)
+			h.add(scene.textures.file(material.normalMap));
+	}
+	return h.value;
+}
+
+// the triangles themselves: an OBJ file edited between renders keeps its name
+uint64_t GBuffer::MeshKey(const TriangleMesh& mesh)
+{
+	SceneHash h;
+	h.add(mesh.vertices);
+	h.add(mesh.indices);
+	return h.value;
+}
+
+uint64_t GBuffer::ShadingKey(const Scene& scene, const RenderSettings& settings)
+{
+	SceneHash h;
+	h.add(scene.lights.size());
+	for (auto& light : scene.lights)
+	{
+		h.add(light.position);
+		h.add(light.intensity);
+		h.add(light.type);
+		h.add(light.radius);
+		h.add(light.samples);
+	}
+	h.add(settings.maxDepth);
+	h.add(settings.maxRaysPerPixel);
+	h.add(settings.lightSamples);
+	return h.value;
+}
+
+uint64_t GBuffer::MaterialKey(const Scene& scene, const Material& m)
+{
+	SceneHash h;
+	h.add(m.color);
+	h.add(m.albedo);
+	h.add(m.specularExponent);
+	h.add(m.checkerColor);
+	h.add(m.checkerSize);
+	if (m.isBump)
+		h.add(scene.textures.file(m.image));
+	return h.value;
+}
+
+void GBuffer::reset(const Scene& scene, const RenderSettings& settings)
+{
+	width = settings.width;
+	height = settings.height;
+	visibilityKey = VisibilityKey(scene, settings);
+	updateKeys(scene, settings);
+	samples.assign(size_t(width) * height, GBufferSample());
+}
+
+void GBuffer::updateKeys(const Scene& scene, const RenderSettings& settings)
+{
+	shadingKey = ShadingKey(scene, settings);
+	materialKeys.clear();
+	for (int i = 0; i < scene.objectCount(); i++)
+		materialKeys.push_back(MaterialKey(scene, scene.material(i)));
+}
+
+bool GBuffer::load(const std::string& file, const Scene& scene, const RenderSettings& settings)
+{
+	FILE* f = fopen(file.c_str(), "rb");
+	if (!f)
+		return false;
+
+	char magic[4];
+	uint64_t count = 0;
+	bool ok = fread(magic, 1, 4, f) == 4 && !memcmp(magic, kGBufferMagic, 4) &&
+		fread(&width, sizeof(width), 1, f) == 1 && fread(&height, sizeof(height), 1, f) == 1 &&
+		fread(&visibilityKey, sizeof(visibilityKey), 1, f) == 1 && fread(&shadingKey, sizeof(shadingKey), 1, f) == 1 &&
+		fread(&count, sizeof(count), 1, f) == 1 &&
+		visibilityKey == VisibilityKey(scene, settings) && count == uint64_t(scene.objectCount());
+	if (ok)
+	{
+		materialKeys.resize(count);
+		samples.resize(size_t(width) * height);
+		ok = fread(materialKeys.data(), sizeof(uint64_t), count, f) == count &&
+			fread(samples.data(), sizeof(GBufferSample), samples.size(), f) == samples.size();
+	}
+	fclose(f);
+	if (!ok)
+		samples.clear();
+	return ok;
+}
+
+bool GBuffer::save(const std::string& file) const
+{
+	FILE* f = fopen(file.c_str(), "wb");
+	if (!f)
+		return false;
+
+	uint64_t count = materialKeys.size();
+	bool ok = fwrite(kGBufferMagic, 1, 4, f) == 4 &&
+		fwrite(&width, sizeof(width), 1, f) == 1 && fwrite(&height, sizeof(height), 1, f) == 1 &&
+		fwrite(&visibilityKey, sizeof(visibilityKey), 1, f) == 1 && fwrite(&shadingKey, sizeof(shadingKey), 1, f) == 1 &&
+		fwrite(&count, sizeof(count), 1, f) == 1 &&
+		fwrite(materialKeys.data(), sizeof(uint64_t), count, f) == count &&
+		fwrite(samples.data(), sizeof(GBufferSample), samples.size(), f) == samples.size();
+	return fclose(f) == 0 && ok;
+}
+
+uint64_t GBuffer::changedObjects(const Scene& scene, const RenderSettings& settings) const
+{
+	if (shadingKey != ShadingKey(scene, settings))
+		return ~uint64_t(0);
+
+	uint64_t changed = 0;
+	for (int i = 0; i < scene.objectCount(); i++)
+		if (materialKeys[i] != MaterialKey(scene, scene.material(i)))
+			changed |= ObjectBit(i);
+	return changed;
+}
+
+HitRecord GBuffer::hit(int i, int j, const Scene& scene, TextureFilter filter) const
+{
+	const GBufferSample& s = at(i, j);
+	HitRecord hit;
+	hit.t = s.t;
+	hit.object = s.object;
+	hit.point = s.point;
+	hit.normal = s.normal;
+	hit.uv = s.uv;
+	hit.footprint = s.footprint;
+	hit.material = nullptr;
+	if (s.t < kInfinity)
+		ResolveMaterial(scene, hit, filter);
+	return hit;
+}
+
+void GBuffer::store(int i, int j, const HitRecord& hit, uint64_t objects, const glm::vec3& radiance)
+{
+	GBufferSample& s = at(i, j);
+	s.t = hit.t;
+	s.object = hit.object;
+	s.point = hit.t < kInfinity ? hit.point : glm::vec3(0.0f);
+	s.normal = hit.t < kInfinity ? hit.normal : glm::vec3(0.0f);
+	s.uv = hit.t < kInfinity ? hit.uv : glm::vec2(0.0f);
+	s.footprint = hit.t < kInfinity ? hit.footprint : glm::vec2(0.0f);
+	s.objects = objects;
+	s.radiance = radiance;
+}
+
+#endif // !__GBUFFER__
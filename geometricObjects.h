@@ -5,20 +5,41 @@
 #include "Ray.h"
 #include "Material.h"
 #include <vector>
-#include <string>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+
+// Primitive types. Scene objects are numbered in this order: spheres first, then planes,
+// boxes, discs, triangle meshes (mesh.h) and instances (instance.h).
+enum class ShapeKind
+{
+	Sphere,
+	Plane,
+	Box,
+	Disc,
+	Mesh,
+	Instance
+};
+static const int kShapeKinds = 6;
+
+enum class SphereType
+{
+	Regular,
+	LightSource // emissive, shown with its own colour and never casts shadows
+};
 
 class Sphere
 {
 public:
 	Sphere() {}
-	Sphere(const glm::vec3& c, const float& r, const Material& m,const std::string t = "none") : center(c), radius(r), material(m),type(t) {}
+	Sphere(const glm::vec3& c, const float& r, const Material& m,const SphereType t = SphereType::Regular) : center(c), radius(r), material(m),type(t) {}
 	Sphere(const Sphere& sphere) : center(sphere.center), radius(sphere.radius), material(sphere.material), type(sphere.type) {}
 	bool hit(const Ray& ray, float& tMin) const;
 
 	glm::vec3 center;
 	float radius;
 	Material material;
-	std::string type;
+	SphereType type;
 	static const float eps;
 };
 
@@ -52,4 +73,157 @@ bool Sphere::hit(const Ray& ray, float& tMin) const
 		return tMin > eps;
 	}
 }
+
+// Axis of the largest normal component, and the two axes spanning the plane across it
+static inline int dominantAxis(const glm::vec3& n)
+{
+	glm::vec3 a = glm::abs(n);
+	return a.x >= a.y && a.x >= a.z ? 0 : (a.y >= a.z ? 1 : 2);
+}
+
+static inline void tangentAxes(int axis, int& a1, int& a2)
+{
+	a1 = axis == 0 ? 1 : 0;
+	a2 = axis == 2 ? 1 : 2;
+}
+
+// Plane through point, optionally cut to a rectangle: a hit only counts when it lies inside
+// [boundsMin, boundsMax] on the two axes across the normal's dominant axis. Without bounds
+// it is infinite and is never culled by the BVH.
+class Plane
+{
+public:
+	Plane(const glm::vec3& p, const glm::vec3& n, const Material& m,
+		const glm::vec3& lo = glm::vec3(-std::numeric_limits<float>::infinity()),
+		const glm::vec3& hi = glm::vec3(std::numeric_limits<float>::infinity()))
+		: point(p), normal(glm::normalize(n)), boundsMin(lo), boundsMax(hi), material(m) {}
+	bool hit(const Ray& ray, float& t) const;
+	void bounds(glm::vec3& lo, glm::vec3& hi) const;
+
+	glm::vec3 point;
+	glm::vec3 normal;
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+	Material material;
+};
+
+bool Plane::hit(const Ray& ray, float& t) const
+{
+	float denom = glm::dot(ray.direction, normal);
+	if (std::fabs(denom) <= 1e-3) // grazing rays miss
+		return false;
+	t = glm::dot(point - ray.origin, normal) / denom;
+	glm::vec3 p = ray.origin + ray.direction * t;
+	int a1, a2;
+	tangentAxes(dominantAxis(normal), a1, a2);
+	return t > 0 && p[a1] > boundsMin[a1] && p[a1] < boundsMax[a1] && p[a2] > boundsMin[a2] && p[a2] < boundsMax[a2];
+}
+
+void Plane::bounds(glm::vec3& lo, glm::vec3& hi) const
+{
+	const float inf = std::numeric_limits<float>::infinity();
+	int axis = dominantAxis(normal), a1, a2;
+	tangentAxes(axis, a1, a2);
+	// the rectangle is padded as well, infinite sides stay infinite
+	lo = boundsMin - 1e-3f * (1.0f + glm::abs(boundsMin));
+	hi = boundsMax + 1e-3f * (1.0f + glm::abs(boundsMax));
+	if (normal[a1] == 0.0f && normal[a2] == 0.0f)
+	{
+		// axis aligned: a thin slab, padded so the BVH box test never rejects a hit on the plane
+		float pad = 1e-3f * (1.0f + std::fabs(point[axis]));
+		lo[axis] = point[axis] - pad;
+		hi[axis] = point[axis] + pad;
+		return;
+	}
+
+	lo[axis] = inf;
+	hi[axis] = -inf;
+	for (int c = 0; c < 4; c++)
+	{
+		float u = c & 1 ? boundsMax[a1] : boundsMin[a1];
+		float v = c & 2 ? boundsMax[a2] : boundsMin[a2];
+		// the dominant coordinate of the plane at the rectangle corner
+		float w = point[axis] - (normal[a1] * (u - point[a1]) + normal[a2] * (v - point[a2])) / normal[axis];
+		if (!std::isfinite(w))
+		{
+			lo[axis] = -inf;
+			hi[axis] = inf;
+			return;
+		}
+		lo[axis] = std::min(lo[axis], w - 1e-3f * (1.0f + std::fabs(w)));
+		hi[axis] = std::max(hi[axis], w + 1e-3f * (1.0f + std::fabs(w)));
+	}
+}
+
+// Axis-aligned box
+class Box
+{
+public:
+	Box(const glm::vec3& lo, const glm::vec3& hi, const Material& m) : min(glm::min(lo, hi)), max(glm::max(lo, hi)), material(m) {}
+	bool hit(const Ray& ray, float& t) const;
+	glm::vec3 normalAt(const glm::vec3& p) const;
+
+	glm::vec3 min;
+	glm::vec3 max;
+	Material material;
+};
+
+bool Box::hit(const Ray& ray, float& t) const
+{
+	glm::vec3 invDir = 1.0f / ray.direction;
+	glm::vec3 t0 = (min - ray.origin) * invDir;
+	glm::vec3 t1 = (max - ray.origin) * invDir;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+	float enter = std::max(std::max(tNear.x, tNear.y), tNear.z);
+	float exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+	if (enter > exit || exit <= Sphere::eps)
+		return false;
+	// from inside the box the exit face is hit
+	t = enter > Sphere::eps ? enter : exit;
+	return true;
+}
+
+glm::vec3 Box::normalAt(const glm::vec3& p) const
+{
+	glm::vec3 d = (p - (min + max) * 0.5f) / glm::max((max - min) * 0.5f, glm::vec3(1e-6f));
+	int axis = dominantAxis(d);
+	glm::vec3 n(0.0f);
+	n[axis] = d[axis] < 0 ? -1.0f : 1.0f;
+	return n;
+}
+
+// Flat disc facing along normal
+class Disc
+{
+public:
+	Disc(const glm::vec3& c, const glm::vec3& n, float r, const Material& m) : center(c), normal(glm::normalize(n)), radius(r), material(m) {}
+	bool hit(const Ray& ray, float& t) const;
+	void bounds(glm::vec3& lo, glm::vec3& hi) const;
+
+	glm::vec3 center;
+	glm::vec3 normal;
+	float radius;
+	Material material;
+};
+
+bool Disc::hit(const Ray& ray, float& t) const
+{
+	float denom = glm::dot(ray.direction, normal);
+	if (std::fabs(denom) < 1e-6f)
+		return false;
+	t = glm::dot(center - ray.origin, normal) / denom;
+	if (t <= Sphere::eps)
+		return false;
+	glm::vec3 d = ray.origin + ray.direction * t - center;
+	return glm::dot(d, d) <= radius * radius;
+}
+
+void Disc::bounds(glm::vec3& lo, glm::vec3& hi) const
+{
+	// extent of the rim along each axis, padded in the flat direction
+	glm::vec3 e = radius * glm::sqrt(glm::max(glm::vec3(1.0f) - normal * normal, glm::vec3(0.0f))) + glm::vec3(1e-3f);
+	lo = center - e;
+	hi = center + e;
+}
 #endif // !__GEOMOBJ__
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+#ifndef __HIT__
+#define __HIT__
+
+#include <glm.hpp>
+#include "material.h"
+
+// Closest hit found by SceneIntersect. Only t, the object and its triangle are tracked while
+// searching, the shading fields are filled once for the final hit.
+struct HitRecord
+{
+	float t;
+	int object; // scene object number, see Scene
+	int primitive; // triangle of a mesh or an instanced mesh, not set for other objects
+
+	glm::vec3 point;
+	glm::vec3 normal;
+	glm::vec3 color; // material colour or the texture sample at the hit
+	const Material* material;
+	glm::vec2 uv; // texture coordinates and their footprint, zero on untextured surfaces
+	glm::vec2 footprint;
+};
+
+#endif // !__HIT__
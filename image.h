@@ -4,22 +4,124 @@
 
 #include<fstream>
 #include<vector>
+#include<cmath>
+#include<algorithm>
 #include<glm.hpp>
 
+enum class TextureFilter
+{
+	Nearest, // one texel of the full resolution image
+	Bilinear, // bilinear lookup in the closest mip level
+	Trilinear // bilinear lookups in the two closest mip levels, blended
+};
+
+// How texels are converted when a texture is created
+enum class TextureKind
+{
+	Color, // rgb in [0, 1]
+	NormalMap // unit vectors along the texel colour
+};
+
+// One level of the mip chain. Texels are stored in 8x8 tiles, so a bilinear
+// footprint usually stays within a few cache lines.
+struct MipLevel
+{
+	static const int tileSize = 8;
+
+	MipLevel(const std::vector<glm::vec3>& pixels, int width, int height);
+
+	int offset(int i, int j) const
+	{
+		int tile = (j / tileSize) * tilesX + i / tileSize;
+		return tile * tileSize * tileSize + (j % tileSize) * tileSize + i % tileSize;
+	}
+	const glm::vec3& texel(int i, int j) const { return texels[offset(i, j)]; }
+
+	int nx, ny;
+	int tilesX;
+	std::vector<glm::vec3> texels;
+};
+
+const int MipLevel::tileSize;
+
+MipLevel::MipLevel(const std::vector<glm::vec3>& pixels, int width, int height) : nx(width), ny(height)
+{
+	tilesX = (nx + tileSize - 1) / tileSize;
+	int tilesY = (ny + tileSize - 1) / tileSize;
+	texels.resize(tilesX * tilesY * tileSize * tileSize);
+	for (int j = 0; j < ny; j++)
+		for (int i = 0; i < nx; i++)
+			texels[offset(i, j)] = pixels[i + nx * j];
+}
+
+// Sampling-ready texture: float texels, converted once when the texture is created.
+// Textures are owned by a TextureRegistry and shared by handle.
 class Image
 {
 
 public:
-	Image() {}
-	Image(unsigned char* pixels, int A, int B) : nx(A), ny(B), data(pixels) {}
-	Image(const Image& i) : nx(i.nx), ny(i.ny), data(i.data){}
+	Image() : nx(0), ny(0), kind(TextureKind::Color) {}
+	// pixels are 8 bit rgb, row by row
+	Image(const unsigned char* pixels, int A, int B, TextureKind k = TextureKind::Color);
 
+	// nearest texel of the full resolution image
 	glm::vec3 value(float u, float v) const;
-	
-	unsigned char* data;
+	// filtered lookup, du and dv are the extent of the sample footprint in texture coordinates
+	glm::vec3 sample(float u, float v, float du, float dv, TextureFilter filter) const;
+
+	int levels() const { return int(mips.size()); }
+
 	int nx, ny;
+	TextureKind kind;
+
+private:
+	glm::vec3 bilinear(float u, float v, int level) const;
+
+	std::vector<MipLevel> mips;
 };
 
+Image::Image(const unsigned char* pixels, int A, int B, TextureKind k) : nx(A), ny(B), kind(k)
+{
+	if (!pixels || nx <= 0 || ny <= 0)
+		return;
+
+	std::vector<glm::vec3> previous(nx * ny), next;
+	for (int i = 0; i < nx * ny; i++)
+	{
+		float r = int(pixels[3 * i]) / 255.0;
+		float g = int(pixels[3 * i + 1]) / 255.0;
+		float b = int(pixels[3 * i + 2]) / 255.0;
+		previous[i] = glm::vec3(r, g, b);
+		if (kind == TextureKind::NormalMap)
+			previous[i] = glm::normalize(previous[i]);
+	}
+	mips.push_back(MipLevel(previous, nx, ny));
+
+	// box filtered chain down to 1x1; along an odd size the last texel of the next level
+	// averages three texels instead of two, so no row or column is dropped
+	auto span = [](int i, int size, int half) { return size == 1 ? 1 : size % 2 && i == half - 1 ? 3 : 2; };
+	int w = nx, h = ny;
+	while (w > 1 || h > 1)
+	{
+		int w2 = std::max(1, w / 2), h2 = std::max(1, h / 2);
+		next.resize(w2 * h2);
+		for (int j = 0; j < h2; j++)
+			for (int i = 0; i < w2; i++)
+			{
+				int cw = span(i, w, w2), ch = span(j, h, h2);
+				glm::vec3 sum(0.0f);
+				for (int y = 2 * j; y < 2 * j + ch; y++)
+					for (int x = 2 * i; x < 2 * i + cw; x++)
+						sum += previous[x + w * y];
+				next[i + w2 * j] = kind == TextureKind::NormalMap ? glm::normalize(sum) : sum / float(cw * ch);
+			}
+		mips.push_back(MipLevel(next, w2, h2));
+		previous.swap(next);
+		w = w2;
+		h = h2;
+	}
+}
+
 glm::vec3 Image::value(float u, float v) const {
 	int i = (u)*nx;
 	int j = (1 - v) * ny - 0.001;
@@ -30,12 +132,48 @@ glm::vec3 Image::value(float u, float v) const {
 	if (i > nx - 1) i = nx - 1;
 	if (j > ny - 1) j = ny - 1;
 
+	return mips[0].texel(i, j);
+}
+
+// u wraps around (longitude on spheres), v is clamped
+glm::vec3 Image::bilinear(float u, float v, int level) const
+{
+	const MipLevel& m = mips[level];
+	float x = u * m.nx - 0.5f;
+	float y = (1 - v) * m.ny - 0.5f;
+	float fx = std::floor(x), fy = std::floor(y);
+	float tx = x - fx, ty = y - fy;
+
+	int i0 = int(fx) % m.nx;
+	if (i0 < 0) i0 += m.nx;
+	int i1 = i0 + 1 == m.nx ? 0 : i0 + 1;
+	int j0 = std::min(std::max(int(fy), 0), m.ny - 1);
+	int j1 = std::min(std::max(int(fy) + 1, 0), m.ny - 1);
+
+	glm::vec3 top = glm::mix(m.texel(i0, j0), m.texel(i1, j0), tx);
+	glm::vec3 bottom = glm::mix(m.texel(i0, j1), m.texel(i1, j1), tx);
+	return glm::mix(top, bottom, ty);
+}
+
+glm::vec3 Image::sample(float u, float v, float du, float dv, TextureFilter filter) const
+{
+	if (filter == TextureFilter::Nearest)
+		return value(u, v);
+
+	// level of detail: texels covered by the footprint along its longer side
+	float texels = std::max(du * nx, dv * ny);
+	float lod = texels > 1.0f ? std::log2(texels) : 0.0f;
+	lod = std::min(lod, float(levels() - 1));
 
-	float r = int(data[3 * i + 3 * nx * j]) / 255.0;
-	float g = int(data[3 * i + 3 * nx * j + 1]) / 255.0;
-	float b = int(data[3 * i + 3 * nx * j + 2]) / 255.0;
+	if (filter == TextureFilter::Bilinear)
+		return bilinear(u, v, int(lod + 0.5f));
 
-	return glm::vec3(r, g, b);
+	int level = int(lod);
+	float t = lod - level;
+	glm::vec3 fine = bilinear(u, v, level);
+	if (t == 0.0f)
+		return fine;
+	return glm::mix(fine, bilinear(u, v, level + 1), t);
 }
 
 
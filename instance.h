@@ -0,0 +1,91 @@
+#pragma once
+#ifndef __INSTANCE__
+#define __INSTANCE__
+
+#include "ray.h"
+#include "aabb.h"
+#include "mesh.h"
+#include "geometricObjects.h"
+#include <glm.hpp>
+#include <memory>
+#include <cmath>
+
+// A placement of shared geometry: a triangle mesh with its BVH, or the unit sphere when mesh
+// is null. It holds a transform and an index into Scene::materials, so a thousand copies of an
+// asset cost a thousand transforms and one mesh. Rays are taken into object space instead of
+// moving the geometry; their directions are not renormalised there, so a distance along the
+// ray is the same in both spaces.
+class Instance
+{
+public:
+	Instance(const std::shared_ptr<const TriangleMesh>& m, const glm::mat4& toWorld, int materialId);
+
+	Ray toObject(const Ray& ray) const { return Ray(inverse * (ray.origin - translation), inverse * ray.direction); }
+	glm::vec3 normalToWorld(const glm::vec3& n) const { return glm::normalize(n * inverse); }
+	// closest hit nearer than tMax and its triangle, -1 for sphere instances; the work inside the
+	// mesh is added to stats
+	bool hit(const Ray& ray, float tMax, float& t, int& triangle, TraversalStats* stats = nullptr) const;
+	bool occluded(const Ray& ray, float maxDist, TraversalStats* stats = nullptr) const;
+	AABB bounds() const;
+
+	std::shared_ptr<const TriangleMesh> mesh;
+	glm::mat3 linear; // object to world, without the translation
+	glm::mat3 inverse;
+	glm::vec3 translation;
+	float scale; // mean scale factor, for texture footprints in object space
+	int material;
+};
+
+Instance::Instance(const std::shared_ptr<const TriangleMesh>& m, const glm::mat4& toWorld, int materialId)
+	: mesh(m), linear(toWorld), inverse(glm::inverse(glm::mat3(toWorld))), translation(toWorld[3]), material(materialId)
+{
+	scale = std::cbrt(std::fabs(glm::determinant(linear)));
+}
+
+// unit sphere at the origin, the direction need not be normalised
+static inline bool hitUnitSphere(const Ray& ray, float& t)
+{
+	float a = glm::dot(ray.direction, ray.direction);
+	float b = glm::dot(ray.origin, ray.direction);
+	float c = glm::dot(ray.origin, ray.origin) - 1.0f;
+	float discriminant = b * b - a * c;
+	if (discriminant < 0)
+		return false;
+	float root = std::sqrt(discriminant);
+	t = (-b - root) / a;
+	if (t <= Sphere::eps)
+		t = (-b + root) / a;
+	return t > Sphere::eps;
+}
+
+bool Instance::hit(const Ray& ray, float tMax, float& t, int& triangle, TraversalStats* stats) const
+{
+	Ray local = toObject(ray);
+	if (mesh)
+		return mesh->closestHit(local, tMax, t, triangle, stats);
+	triangle = -1;
+	return hitUnitSphere(local, t) && t < tMax;
+}
+
+bool Instance::occluded(const Ray& ray, float maxDist, TraversalStats* stats) const
+{
+	Ray local = toObject(ray);
+	if (mesh)
+		return mesh->occluded(local, maxDist, stats);
+	float t;
+	return hitUnitSphere(local, t) && t < maxDist;
+}
+
+AABB Instance::bounds() const
+{
+	AABB local = mesh ? mesh->bounds() : AABB(glm::vec3(-1.0f), glm::vec3(1.0f));
+	AABB box;
+	for (int c = 0; c < 8; c++)
+	{
+		glm::vec3 corner(c & 1 ? local.max.x : local.min.x, c & 2 ? local.max.y : local.min.y, c & 4 ? local.max.z : local.min.z);
+		box.grow(linear * corner + translation);
+	}
+	return box;
+}
+
+#endif // !__INSTANCE__
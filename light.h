@@ -3,17 +3,26 @@
 #define __LIGHT__
 
 #include <glm.hpp>
-#include <string>
+
+enum class LightType
+{
+    Ambient,
+    Point,
+    Sphere // spherical area light, sampled by solid angle
+};
 
 class Light
 {
 public:
-    Light(const glm::vec3& p, const float& i,const std::string t) : position(p), intensity(i), type(t) { }
-    Light(const Light& l) : position(l.position), intensity(l.intensity), type(l.type) { }
+    Light(const glm::vec3& p, const float& i,const LightType t, float r = 0.0f, int s = 1) :
+        position(p), intensity(i), type(t), radius(r), samples(s) { }
+    Light(const Light& l) : position(l.position), intensity(l.intensity), type(l.type), radius(l.radius), samples(l.samples) { }
 
     glm::vec3 position;
     float intensity;
-    std::string type;
+    LightType type;
+    float radius; // sphere lights only
+    int samples; // shadow rays per shading point for sphere lights
 };
 
 #endif // !__LIGHT__
\ No newline at end of file
@@ -1,276 +1,470 @@
 #include <glm.hpp>
-#include <gtc/constants.hpp>
-#include "scene.h"
-#include "ray.h"
-#include "material.h"
-#include <algorithm>
 #include <iostream>
-#include "image.h"
-#include <random>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stbi_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
+#include "tracer.h"
+#include "settings.h"
+#include "tileScheduler.h"
+#include "sceneLoader.h"
+#include "bandWriter.h"
+#include "pfm.h"
+#include "stats.h"
+#include "gbuffer.h"
 
 #define _CRT_SECURE_NO_WARNINGS
 
-static const float kInfinity = std::numeric_limits<float>::max();
-static const glm::vec3 kDefaultBackgroundColor = glm::vec3(0.235294, 0.67451, 0.843137);
-
-
-glm::vec3 reflect(const glm::vec3& I, const glm::vec3& N)
+// Regenerates the 8 bit output from a PFM written by an earlier render, with the current tone map
+bool toneMapFile(const std::string& hdrFile, const RenderSettings& settings)
 {
-    return N * glm::dot(N, I) * 2.0f - I;
-}
+    PfmReader input;
+    if (!input.open(hdrFile))
+    {
+        std::cerr << "cannot read " << hdrFile << std::endl;
+        return false;
+    }
 
-void getSphereTextureCoordinats(const glm::vec3& p, float& u, float& v) {
-    float r = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
-    float phi = std::atan2(-p.z,p.x);
-    u = (phi + glm::pi<float>()) / (2 * glm::pi<float>());
-    float theta = glm::acos(-p.y / r);
-    v = theta / glm::pi<float>();
-}
+    BandWriter output(input.width, input.height, 64, settings.toneMap);
+    if (!output.open(settings.output, "", 100))
+    {
+        std::cerr << "cannot write " << settings.output << std::endl;
+        return false;
+    }
 
-bool SceneIntersect(const Ray& ray, const std::vector<Sphere>& spheres, glm::vec3& hit,
-    glm::vec3& normal, Material& material,Sphere& sphere)
-{
-    float spheres_dist = kInfinity;
-    for (int i = 0; i < spheres.size(); i++)
+    std::vector<glm::vec3> row(input.width);
+    for (int j = 0; j < input.height; j++)
     {
-        float dist;
-        if (spheres[i].hit(ray, dist) && dist < spheres_dist)
+        if (!input.readRow(j, row.data()))
         {
-            spheres_dist = dist;
-            hit = ray.origin + ray.direction * dist;
-            material.copy(spheres[i].material);
-            normal = hit - spheres[i].center;
-            if (spheres[i].material.isBump)
-            {
-                float u, v;
-                getSphereTextureCoordinats(normal, u, v);
-                normal = material.normalMap.value(u, v);
-                material.color = material.image.value(u,v) ;
-            }  
-            normal = glm::normalize(normal);
-            sphere = spheres[i];
+            std::cerr << "cannot read " << hdrFile << std::endl;
+            return false;
         }
+        output.write(Tile{ 0, j, input.width, j + 1 }, row.data());
     }
+    return output.close();
+}
 
-    float checkerboard_dist = kInfinity;
-    if (fabs(ray.direction.y) > 1e-3) 
+// Intersection work per pixel on a log scale, black for the cheapest pixels, white for the most expensive
+bool writeHeatmap(const std::string& file, const std::vector<uint32_t>& cost, int width, int height)
+{
+    uint32_t peak = std::max<uint32_t>(1, *std::max_element(cost.begin(), cost.end()));
+    float scale = 1.0f / std::log(1.0f + peak);
+    std::vector<unsigned char> pixels(3 * cost.size());
+    for (size_t i = 0; i < cost.size(); i++)
     {
-        float d = -(ray.origin.y + 4) / ray.direction.y; // the checkerboard plane has equation y = -4
-        glm::vec3 pt = ray.origin + ray.direction * d;
-        if (d > 0 && fabs(pt.x) < 30 && pt.z<2 && pt.z>-50 && d < spheres_dist) {
-            checkerboard_dist = d;
-            hit = pt;
-            normal = glm::vec3(0, 1, 0);
-            material.color = (int(0.5f * hit.x + 1000) + int(0.5f * hit.z)) & 1 ? glm::vec3(1.0f, 1.0f, 1.0f) 
-               : glm::vec3(0.39f, 0.11f, 0.79f);
-            material.color = material.color * 0.3f;
-            material.albedo[2] = 0.1f;
-        }
+        glm::vec3 c = HeatColor(std::log(1.0f + cost[i]) * scale);
+        pixels[3 * i] = (unsigned char)(255 * c.r);
+        pixels[3 * i + 1] = (unsigned char)(255 * c.g);
+        pixels[3 * i + 2] = (unsigned char)(255 * c.b);
     }
-
-    return std::min(spheres_dist, checkerboard_dist) < 1000;
+    return stbi_write_jpg(file.c_str(), width, height, 3, pixels.data(), 100) != 0;
 }
 
-void Lighting(const Scene& scene,glm::vec3& normal, glm::vec3& hitPoint,
-    const glm::vec3& v,float& specularExp,float& diffuse, float& specular, float& back)
+// Renders the image and streams it to settings.output, false if it could not be written
+bool render(const Scene& scene, const RenderSettings& settings)
 {
-    std::for_each(scene.lights.begin(),scene.lights.end(), [&](auto& light)
+    const int width = settings.width;
+    const int height = settings.height;
+
+    TileScheduler scheduler(width, height, settings.tileSize, settings.threads);
+    BandWriter output(width, height, settings.tileSize, settings.toneMap);
+    if (!output.open(settings.output, settings.hdrOutput, 100))
+    {
+        std::cerr << "cannot write " << settings.output << std::endl;
+        return false;
+    }
+
+    // primary hits of an earlier render: only pixels that saw a changed object are shaded again
+    bool useGBuffer = !settings.gbufferFile.empty();
+    if (useGBuffer && settings.integrator != Integrator::Glossy)
+    {
+        std::cerr << "the G-buffer needs the glossy integrator, it is not used" << std::endl;
+        useGBuffer = false;
+    }
+    GBuffer gbuffer;
+    bool reuse = useGBuffer && gbuffer.load(settings.gbufferFile, scene, settings);
+    uint64_t changed = reuse ? gbuffer.changedObjects(scene, settings) : 0;
+    if (useGBuffer && !reuse)
+        gbuffer.reset(scene, settings);
+    std::atomic<long long> shadedPixels(0);
+
+    // every worker only touches its own context and tile times; tiles never overlap in the cost buffer
+    // or in the G-buffer
+    std::vector<TraceContext> contexts(scheduler.threads());
+    std::vector<std::vector<TileTime>> tileTimes(scheduler.threads());
+    std::vector<uint32_t> cost(settings.heatmapOutput.empty() ? 0 : size_t(width) * height);
+    std::atomic<long long> totalSamples(0);
+
+    auto start = std::chrono::steady_clock::now();
+    scheduler.run([&](const Tile& tile, int worker)
         {
-            if (light.type == "ambient")
-                back += light.intensity;
+            auto tileStart = std::chrono::steady_clock::now();
+            TraceContext& context = contexts[worker];
+            int tileWidth = tile.x1 - tile.x0;
+            std::vector<glm::vec3> colors(tileWidth * (tile.y1 - tile.y0));
+            std::vector<uint32_t> tileCost(colors.size(), 0);
+            if (settings.integrator == Integrator::Path)
+            {
+                long long samples = 0;
+                int k = 0;
+                for (int j = tile.y0; j < tile.y1; j++)
+                    for (int i = tile.x0; i < tile.x1; i++, k++)
+                    {
+                        uint64_t before = context.stats.cost();
+                        colors[k] = SamplePixel(scene, settings, i, j, samples, &context.stats, &context.shadowCache);
+                        tileCost[k] = uint32_t(context.stats.cost() - before);
+                    }
+                totalSamples += samples;
+                shadedPixels += k;
+            }
             else
             {
-                if (light.type == "point")
-                {
-                    glm::vec3 lightDir = glm::normalize(light.position - hitPoint);
-                    float lightDistance = glm::length(light.position - hitPoint);
-                    
-                    glm::vec3 shadowOrig = glm::dot(lightDir, normal) < 0 ? hitPoint - normal * 1e-3f : hitPoint + normal * 1e-3f;
-                    glm::vec3 shadowDir = glm::normalize(light.position - hitPoint);
-                    glm::vec3 shadowPt, shadowN;
-                    glm::vec3 shadowPt1, shadowN1;
-                    glm::vec3 shadowPt2, shadowN2;
-                    glm::vec3 shadowPt3, shadowN3;
-                    glm::vec3 shadowPt4, shadowN4;
-                    Material tmpMaterial;
-                    Sphere tmpSphere;
-
-                    auto sceneIntersect = SceneIntersect(Ray(shadowOrig, shadowDir),scene.spheres, shadowPt,
-                        shadowN, tmpMaterial,tmpSphere);
-                    auto sceneIntersect1 = SceneIntersect(Ray(shadowOrig,glm::normalize(shadowDir + glm::vec3(0.01f))), scene.spheres, shadowPt1,
-                        shadowN1, tmpMaterial, tmpSphere);
-                    auto sceneIntersect2 = SceneIntersect(Ray(shadowOrig, glm::normalize(shadowDir - glm::vec3(0.01f))), scene.spheres, shadowPt2,
-                        shadowN2, tmpMaterial, tmpSphere);
-                    auto sceneIntersect3 = SceneIntersect(Ray(shadowOrig, glm::normalize(shadowDir + glm::vec3(0.02f))), scene.spheres, shadowPt3,
-                        shadowN3, tmpMaterial, tmpSphere);
-                    auto sceneIntersect4 = SceneIntersect(Ray(shadowOrig, glm::normalize(shadowDir - glm::vec3(0.02f))), scene.spheres, shadowPt4,
-                        shadowN4, tmpMaterial, tmpSphere);
-
-                    auto intersect = sceneIntersect || sceneIntersect1 || sceneIntersect2 || sceneIntersect3 || sceneIntersect4;
-                    shadowPt = (shadowPt + shadowPt1 + shadowPt2 + shadowPt3 + shadowPt4) / 5.0f;
-
-                    if (!intersect || tmpSphere.type == "lightSpere" || glm::length(shadowPt - shadowOrig) > lightDistance)
+                // pixels to shade, with their cached primary hits when the G-buffer is reused
+                std::vector<Ray> rays;
+                std::vector<HitRecord> cached;
+                std::vector<int> pixels;
+                int k = 0;
+                for (int j = tile.y0; j < tile.y1; j++)
+                    for (int i = tile.x0; i < tile.x1; i++, k++)
                     {
-                        float nl = glm::dot(normal, lightDir);
-                        diffuse += std::max(0.0f, nl) * light.intensity;
-
-                        glm::vec3 h = glm::normalize(lightDir + v);
-                        float nh = glm::dot(normal, h);
-                        float m =1.0f;
-                        float nv = glm::dot(normal, v);
-                        float sigma = glm::pow(0.3, 2.0f);
-                        float d = sigma / (glm::pi<float>() * glm::pow(nh * nh * (sigma - 1) + 1, 2.0f));
-                        float f = glm::clamp(std::fabs(nv), 0.1f, 0.9f);;
-                        float k = 2 * nh / glm::dot(h, v);
-                        float g = std::min(1.0f, std::min(k * nv, k * nl));
-                        float ct = d * f * g / (glm::pi<float>() * nv * nl);
-
-                        specular += light.intensity * std::max(0.0f, ct);
+                        if (reuse)
+                        {
+                            if (!(gbuffer.at(i, j).objects & changed))
+                            {
+                                colors[k] = gbuffer.at(i, j).radiance;
+                                continue;
+                            }
+                            cached.push_back(gbuffer.hit(i, j, scene, settings.textureFilter));
+                        }
+                        rays.push_back(CameraRay(settings, i, j));
+                        pixels.push_back(k);
                     }
+
+                std::vector<glm::vec3> shaded(rays.size());
+                if (!rays.empty())
+                    TraceBatch(scene, settings, rays, shaded.data(), context, reuse ? cached.data() : nullptr);
+                for (size_t n = 0; n < pixels.size(); n++)
+                {
+                    int i = tile.x0 + pixels[n] % tileWidth, j = tile.y0 + pixels[n] / tileWidth;
+                    colors[pixels[n]] = shaded[n];
+                    tileCost[pixels[n]] = context.pixelCost[n];
+                    if (useGBuffer)
+                        gbuffer.store(i, j, context.primaryHits[n], context.pixelObjects[n], shaded[n]);
                 }
+                shadedPixels += pixels.size();
             }
+            output.write(tile, colors.data());
+
+            if (!cost.empty())
+                for (int j = tile.y0; j < tile.y1; j++)
+                    std::copy(tileCost.begin() + (j - tile.y0) * tileWidth,
+                        tileCost.begin() + (j - tile.y0 + 1) * tileWidth, cost.begin() + size_t(j) * width + tile.x0);
+            tileTimes[worker].push_back(TileTime{ tile,
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tileStart).count(), worker });
         });
-}
-
-glm::vec3 Trace(const Ray& ray, Scene& scene, int depth = 0)
-{
-    glm::vec3 point, normal;
-    Material material;
-    Sphere closetSphere;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-    if (depth > 3 || !SceneIntersect(ray, scene.spheres, point, normal, material, closetSphere))
+    if (!output.close())
     {
-        return kDefaultBackgroundColor;
+        std::cerr << "failed to write " << settings.output << std::endl;
+        return false;
     }
 
-    if (closetSphere.type == "lightSpere")
-        return material.color;
-    
-    bool outside = glm::dot(normal, ray.direction) < 0;
-    
-    glm::vec3 returnedColor(0);
-    glm::vec3 reflectedColor(0);
-    if (material.albedo[2] > 0.0f)
+    RenderStats stats;
+    std::vector<TileTime> tiles;
+    for (int worker = 0; worker < scheduler.threads(); worker++)
     {
-        glm::vec3 reflectDir = glm::normalize(-reflect(ray.direction, normal));
-        glm::vec3 reflectDir1 = glm::normalize(-reflect(ray.direction, glm::normalize(normal + glm::vec3(0.01f))));
-        glm::vec3 reflectDir2 = glm::normalize(-reflect(ray.direction, glm::normalize(normal + glm::vec3(0.02f))));
-        glm::vec3 reflectDir3 = glm::normalize(-reflect(ray.direction, glm::normalize(normal - glm::vec3(0.01f))));
-        glm::vec3 reflectDir4 = glm::normalize(-reflect(ray.direction, glm::normalize(normal - glm::vec3(0.02f))));
-        glm::vec3 reflectDir5 = glm::normalize(-reflect(ray.direction, glm::normalize(normal + glm::vec3(0.001f))));
-        glm::vec3 reflectDir6 = glm::normalize(-reflect(ray.direction, glm::normalize(normal - glm::vec3(0.001f))));
-        glm::vec3 reflectOrigin = outside < 0 ? point - normal * 1e-2f : point + normal * 1e-2f;
-        reflectedColor = (Trace(Ray(reflectOrigin, reflectDir), scene, depth + 1) +
-            Trace(Ray(reflectOrigin, reflectDir1), scene, depth + 1) +
-            Trace(Ray(reflectOrigin, reflectDir2), scene, depth + 1) +
-            Trace(Ray(reflectOrigin, reflectDir3), scene, depth + 1) +
-            Trace(Ray(reflectOrigin, reflectDir4), scene, depth + 1) +
-            Trace(Ray(reflectOrigin, reflectDir5), scene, depth + 1) +
-            Trace(Ray(reflectOrigin, reflectDir6), scene, depth + 1)) / 7.0f;
+        stats.add(contexts[worker].stats);
+        tiles.insert(tiles.end(), tileTimes[worker].begin(), tileTimes[worker].end());
     }
-
-    float diffuse = 0, specular = 0, back = 0;
-    Lighting(scene, normal, point, -ray.direction, material.specularExponent, diffuse, specular, back);
-    
-    returnedColor = material.color * back + material.color * diffuse * material.albedo[0] +
-        glm::vec3(0.7f, 0.7f, 0.0f) * specular * material.albedo[1] + reflectedColor * material.albedo[2];
-    returnedColor.r = std::min(1.0f, returnedColor.r);
-    returnedColor.g = std::min(1.0f, returnedColor.g);
-    returnedColor.b = std::min(1.0f, returnedColor.b);
-    return returnedColor;
-}
-
-void render(Scene& scene)
-{
-    const int width = 4000;
-    const int height = 2000;
-    constexpr auto fov = glm::pi<float>() / 2;
-    std::vector<glm::vec3> framebuffer(width * height);
-    float imageAspectRatio = width / (float)height;
-
-    for (size_t j = 0; j < height; j++)
+    PrintSummary(std::cout, stats, tiles, seconds, scheduler.threads());
+    if (settings.integrator == Integrator::Path)
+        std::cout << "samples per pixel: " << double(totalSamples) / (double(width) * height) << std::endl;
+    std::vector<const TriangleMesh*> meshes = scene.meshGeometry();
+    if (!meshes.empty())
     {
-        for (size_t i = 0; i < width; i++) {
-            float Px = (2 * (i + 0.5f) / (float)width - 1) * std::tanf(fov / 2.0f) * imageAspectRatio;
-            float Py = (1 - 2 * (j + 0.5) / (float)height) * std::tanf(fov / 2.0f);
-            glm::vec3 rayDirection = glm::normalize(glm::vec3(Px, Py, -1));
-            framebuffer[i + j * width] = Trace(Ray(glm::vec3(0, 0, 0), rayDirection), scene);
+        // meshes too large for the quantised nodes keep the full tree
+        size_t nodeBytes = 0;
+        int compressed = 0;
+        for (const TriangleMesh* mesh : meshes)
+        {
+            nodeBytes += mesh->nodeBytes();
+            compressed += mesh->compressed();
         }
+        std::cout << "mesh BVH: " << compressed << " of " << meshes.size() << " meshes compressed, "
+            << nodeBytes / double(1 << 20) << " MB of nodes, " << stats.traversal.steps * 1e-6 << " M steps" << std::endl;
     }
+    if (reuse)
+        std::cout << "G-buffer reused, shaded " << shadedPixels << " of " << size_t(width) * height << " pixels" << std::endl;
 
+    // the samples now hold this render's shading, the next one compares against its keys
+    if (reuse)
+        gbuffer.updateKeys(scene, settings);
+    if (useGBuffer && !gbuffer.save(settings.gbufferFile))
+    {
+        std::cerr << "cannot write " << settings.gbufferFile << std::endl;
+        return false;
+    }
 
-    std::vector<unsigned char> imageData;
-    for (auto&& elem : framebuffer)
+    if (!cost.empty() && !writeHeatmap(settings.heatmapOutput, cost, width, height))
     {
-        imageData.push_back((unsigned char)(255 * elem.r));
-        imageData.push_back((unsigned char)(255 * elem.g));
-        imageData.push_back((unsigned char)(255 * elem.b));
+        std::cerr << "cannot write " << settings.heatmapOutput << std::endl;
+        return false;
     }
+    return true;
+}
 
-    stbi_write_jpg("out.jpg", width, height, 3, imageData.data(), 100);
+void printUsage()
+{
+    std::cout << "usage: raytracing [scene file] [options]\n"
+        "  --width N, --height N   image size (default 4000x2000 or the scene file's resolution)\n"
+        "  --output FILE           output image (default out.jpg)\n"
+        "  --hdr FILE              also write the unclamped radiance as a PFM file\n"
+        "  --exposure E            exposure correction in stops before tone mapping\n"
+        "  --tone-operator clamp|reinhard\n"
+        "  --tonemap FILE          no rendering, tone map a PFM file into --output\n"
+        "  --heatmap FILE          also write the intersection work of every pixel as an image\n"
+        "  --gbuffer FILE          keep the primary hits in FILE and reuse them in the next render: only pixels\n"
+        "                          that saw a changed material or light are shaded again (glossy integrator)\n"
+        "  --preview               quarter resolution and reduced sample counts, other options still override it\n"
+        "  --threads N             worker threads, 0 - one per hardware thread\n"
+        "  --tile N                tile size in pixels\n"
+        "  --depth N               last traced bounce\n"
+        "  --max-rays N            glossy tree ray budget per pixel\n"
+        "  --integrator glossy|path\n"
+        "  --spp N                 samples per pixel of the path integrator (the maximum with --adaptive)\n"
+        "  --adaptive E            path integrator: stop sampling a pixel once its standard error is below E\n"
+        "  --light-samples N       shadow rays per sphere light\n"
+        "  --packet 1|4|8|16       rays traced together as a packet, 1 - one at a time\n"
+        "  --shadow-cache on|off   test the last blocker of each light before traversing shadow rays (default on)\n"
+        "  --sort on|off           glossy integrator: trace rays sorted by origin cell and direction octant and\n"
+        "                          shade hits grouped by material (default on)\n"
+        "  --filter nearest|bilinear|trilinear  texture filtering (default trilinear)\n"
+        "  --bvh full|compressed   mesh BVH nodes: binary with float boxes (default) or four-wide with 8-bit boxes\n";
 }
 
-int main()
+// Applies the command line options on top of the scene file settings
+bool parseArguments(int argc, char** argv, RenderSettings& settings)
 {
-    int x = 1270;
-    int y = 770;
-    int n = 3;
-    unsigned char* barknmpImage = stbi_load("Bark_NRM.jpg", &x, &y, &n, 0);
-    Image barkNMP(barknmpImage, x, y);
-    unsigned char* barkImage = stbi_load("Bark.jpg", &x, &y, &n, 0);
-    Image bark(barkImage, x, y);
+    // the preview only lowers the defaults, options given next to it still apply
+    for (int i = 1; i < argc; i++)
+        if (!strcmp(argv[i], "--preview"))
+        {
+            settings.applyPreview();
+            break;
+        }
 
-    x = 500;
-    y = 500;
-    unsigned char* wallNMPImage = stbi_load("wallNMP.jpg", &x, &y, &n, 0);
-    Image wallNMP(wallNMPImage, x, y);
-    unsigned char* wallImage = stbi_load("wall.jpg", &x, &y, &n, 0);
-    Image wall(wallImage, x, y);
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-')
+            continue; // the scene file
+        if (!strcmp(argv[i], "--preview"))
+            continue;
+        if (i + 1 >= argc)
+        {
+            std::cerr << "missing value for " << argv[i] << std::endl;
+            return false;
+        }
 
-    x = 512;
-    y = 340;
-    unsigned char* foilNMPImage = stbi_load("foilNMP.jpg", &x, &y, &n, 0);
-    Image foilNMP(foilNMPImage, x, y);
-    unsigned char* foilImage = stbi_load("foil.jpg", &x, &y, &n, 0);
-    Image foil(foilImage, x, y);
+        const char* value = argv[++i];
+        if (!strcmp(argv[i - 1], "--width"))
+            settings.width = atoi(value);
+        else if (!strcmp(argv[i - 1], "--height"))
+            settings.height = atoi(value);
+        else if (!strcmp(argv[i - 1], "--output"))
+            settings.output = value;
+        else if (!strcmp(argv[i - 1], "--hdr"))
+            settings.hdrOutput = value;
+        else if (!strcmp(argv[i - 1], "--heatmap"))
+            settings.heatmapOutput = value;
+        else if (!strcmp(argv[i - 1], "--gbuffer"))
+            settings.gbufferFile = value;
+        else if (!strcmp(argv[i - 1], "--exposure"))
+            settings.toneMap.exposure = float(atof(value));
+        else if (!strcmp(argv[i - 1], "--tone-operator"))
+        {
+            if (!strcmp(value, "clamp"))
+                settings.toneMap.op = ToneOperator::Clamp;
+            else if (!strcmp(value, "reinhard"))
+                settings.toneMap.op = ToneOperator::Reinhard;
+            else
+            {
+                std::cerr << "unknown tone operator " << value << std::endl;
+                return false;
+            }
+        }
+        else if (!strcmp(argv[i - 1], "--tonemap"))
+            continue; // handled in main
+        else if (!strcmp(argv[i - 1], "--threads"))
+            settings.threads = atoi(value);
+        else if (!strcmp(argv[i - 1], "--tile"))
+            settings.tileSize = atoi(value);
+        else if (!strcmp(argv[i - 1], "--depth"))
+            settings.maxDepth = atoi(value);
+        else if (!strcmp(argv[i - 1], "--max-rays"))
+            settings.maxRaysPerPixel = atoi(value);
+        else if (!strcmp(argv[i - 1], "--integrator"))
+        {
+            if (!strcmp(value, "glossy"))
+                settings.integrator = Integrator::Glossy;
+            else if (!strcmp(value, "path"))
+                settings.integrator = Integrator::Path;
+            else
+            {
+                std::cerr << "unknown integrator " << value << std::endl;
+                return false;
+            }
+        }
+        else if (!strcmp(argv[i - 1], "--spp"))
+            settings.samplesPerPixel = atoi(value);
+        else if (!strcmp(argv[i - 1], "--light-samples"))
+            settings.lightSamples = atoi(value);
+        else if (!strcmp(argv[i - 1], "--packet"))
+        {
+            settings.packetSize = atoi(value);
+            if (settings.packetSize != 1 && settings.packetSize != 4 && settings.packetSize != 8 && settings.packetSize != 16)
+            {
+                std::cerr << "packet size must be 1, 4, 8 or 16" << std::endl;
+                return false;
+            }
+        }
+        else if (!strcmp(argv[i - 1], "--shadow-cache"))
+        {
+            if (strcmp(value, "on") && strcmp(value, "off"))
+            {
+                std::cerr << "--shadow-cache takes on or off" << std::endl;
+                return false;
+            }
+            settings.shadowCache = !strcmp(value, "on");
+        }
+        else if (!strcmp(argv[i - 1], "--sort"))
+        {
+            if (strcmp(value, "on") && strcmp(value, "off"))
+            {
+                std::cerr << "--sort takes on or off" << std::endl;
+                return false;
+            }
+            settings.sortBatches = !strcmp(value, "on");
+        }
+        else if (!strcmp(argv[i - 1], "--filter"))
+        {
+            if (!strcmp(value, "nearest"))
+                settings.textureFilter = TextureFilter::Nearest;
+            else if (!strcmp(value, "bilinear"))
+                settings.textureFilter = TextureFilter::Bilinear;
+            else if (!strcmp(value, "trilinear"))
+                settings.textureFilter = TextureFilter::Trilinear;
+            else
+            {
+                std::cerr << "unknown texture filter " << value << std::endl;
+                return false;
+            }
+        }
+        else if (!strcmp(argv[i - 1], "--bvh"))
+        {
+            if (!strcmp(value, "full"))
+                settings.bvhFormat = BVHFormat::Full;
+            else if (!strcmp(value, "compressed"))
+                settings.bvhFormat = BVHFormat::Compressed;
+            else
+            {
+                std::cerr << "unknown BVH format " << value << std::endl;
+                return false;
+            }
+        }
+        else if (!strcmp(argv[i - 1], "--adaptive"))
+        {
+            settings.adaptive = true;
+            settings.adaptiveThreshold = float(atof(value));
+        }
+        else
+        {
+            std::cerr << "unknown option " << argv[i - 1] << std::endl;
+            return false;
+        }
+    }
 
-    Material ivory(glm::vec3(0.4f, 0.4f, 0.3f), 50.0f,glm::vec4(0.6, 0.3, 0.1, 0.0));
-    Material redRubber(glm::vec3(0.3f, 0.1f, 0.1f), 10.0f, glm::vec4(0.9, 0.1, 0.0, 0.0));
-    Material rock(glm::vec3(0.5f, 0.48f, 0.48f), 10.0f,glm::vec4(0.9, 0.1, 0.0, 0.0), true, barkNMP,bark);
-    Material wallM(glm::vec3(1.0f, 0.0f, 0.0f), 15.0f, glm::vec4(0.9, 0.1, 0.0, 0.0), true, wallNMP, wall);
-    Material foilM(glm::vec3(0.0, 0.0, 0.0), 10.0f, glm::vec4(0.9, 0.4, 0.0, 0.0), true, foilNMP, foil);
-    Material mirror(glm::vec3(0.84f, 0.3f, 0.61f), 125.0f, glm::vec4(0.0, 0.9, 0.8, 0.0));
-    Material light(glm::vec3(0.9f, 0.9f, 0.9f), 0.0f, glm::vec4(1.0f,0.0f,0.0f,0.0f));
+    if (settings.width <= 0 || settings.height <= 0)
+    {
+        std::cerr << "image size has to be positive" << std::endl;
+        return false;
+    }
+    if (settings.samplesPerPixel < 1 || settings.maxRaysPerPixel < 1 || settings.tileSize < 1)
+    {
+        std::cerr << "samples per pixel, rays per pixel and tile size have to be positive" << std::endl;
+        return false;
+    }
+    if (settings.maxDepth < 0 || settings.lightSamples < 0 || settings.threads < 0)
+    {
+        std::cerr << "depth, light samples and threads cannot be negative" << std::endl;
+        return false;
+    }
+    return true;
+}
 
-    Scene mainScene;
-    mainScene.spheres.push_back(Sphere(glm::vec3(-3, 0 ,-15), 2, ivory));
-    mainScene.spheres.push_back(Sphere(glm::vec3(-1.0f,-1.5f, -12), 2, rock));
-    mainScene.spheres.push_back(Sphere(glm::vec3(1.5, -0.5, -18), 3, redRubber));
-    mainScene.spheres.push_back(Sphere(glm::vec3(7, 5, -18), 4, mirror));
-    mainScene.spheres.push_back(Sphere(glm::vec3(-5.0f, 7.0f, -10.0f),0.5f, light,"lightSpere"));
-    mainScene.spheres.push_back(Sphere(glm::vec3(-9.0, 0.0, -13.0f), 2, wallM));
-    mainScene.spheres.push_back(Sphere(glm::vec3(8.0, 0.0, -10), 2.0f, foilM));
+int main(int argc, char** argv)
+{
+    RenderSettings settings;
+    Scene scene;
 
-    mainScene.lights.push_back(Light(glm::vec3(30, 50, -25),0.7f,"point"));
-    mainScene.lights.push_back(Light(glm::vec3(30, 20, 30), 0.3f,"point"));
+    const char* sceneFile = nullptr;
+    const char* hdrInput = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] == '-')
+        {
+            if (!strcmp(argv[i], "--help"))
+            {
+                printUsage();
+                return 0;
+            }
+            if (!strcmp(argv[i], "--tonemap") && i + 1 < argc)
+                hdrInput = argv[i + 1];
+            // the mesh BVHs are built while the scene file loads
+            if (!strcmp(argv[i], "--bvh") && i + 1 < argc && !strcmp(argv[i + 1], "compressed"))
+                settings.bvhFormat = BVHFormat::Compressed;
+            if (strcmp(argv[i], "--preview"))
+                i++;
+        }
+        else
+            sceneFile = argv[i];
+    }
 
-    glm::vec3 center(-5.0f, 7.0f, -10.0f);
+    if (hdrInput)
+    {
+        if (!parseArguments(argc, argv, settings))
+        {
+            printUsage();
+            return 1;
+        }
+        return toneMapFile(hdrInput, settings) ? 0 : 1;
+    }
 
-    mainScene.lights.push_back(Light(glm::vec3(sqrt(3) / 12, sqrt(3) / 12, sqrt(3) / 12) + center, 0.1f, "point"));
-    mainScene.lights.push_back(Light(glm::vec3(sqrt(3) / 12, sqrt(3) / 12, -sqrt(3) / 12) + center, 0.1f, "point"));
-    mainScene.lights.push_back(Light(glm::vec3(-sqrt(3) / 12, sqrt(3) / 12, -sqrt(3) / 12) + center, 0.1f, "point"));
-    mainScene.lights.push_back(Light(glm::vec3(-sqrt(3) / 12, sqrt(3) / 12, sqrt(3) / 12) + center, 0.1f, "point"));
-    mainScene.lights.push_back(Light(glm::vec3(-sqrt(3) / 12, -sqrt(3) / 12, -sqrt(3) / 12) + center, 0.1f, "point"));
-    mainScene.lights.push_back(Light(glm::vec3(-sqrt(3) / 12, -sqrt(3) / 12, sqrt(3) / 12) + center, 0.1f, "point"));
-    mainScene.lights.push_back(Light(glm::vec3(sqrt(3) / 12, -sqrt(3) / 12, sqrt(3) / 12) + center, 0.1f, "point"));
-    mainScene.lights.push_back(Light(glm::vec3(sqrt(3) / 12, -sqrt(3) / 12, -sqrt(3) / 12) + center, 0.1f, "point"));
-    mainScene.lights.push_back(Light(center, 0.1f, "point"));
+    if (sceneFile)
+    {
+        SceneLoader loader;
+        if (!loader.load(sceneFile, scene, settings))
+        {
+            std::cerr << loader.error << std::endl;
+            return 1;
+        }
+    }
+    else
+        buildDefaultScene(scene);
 
-    mainScene.lights.push_back(Light(glm::vec3(-10, 30, 30), 0.2f, "ambient"));
+    if (!parseArguments(argc, argv, settings))
+    {
+        printUsage();
+        return 1;
+    }
 
-    render(mainScene);
-}
\ No newline at end of file
+    return render(scene, settings) ? 0 : 1;
+}
@@ -3,17 +3,17 @@
 #define __MATERIAL__
 
 #include <glm.hpp>
-#include "image.h"
 
 class Material
 {
 public:
 
-    Material(const glm::vec3& c, const float& spec,const glm::vec4& a, bool m = false, const Image& nmp = Image(NULL,0,0),
-        const Image& i = Image(NULL, 0, 0)) :
+    // nmp and i are TextureRegistry handles of the normal map and the colour texture
+    Material(const glm::vec3& c, const float& spec,const glm::vec4& a, bool m = false, int nmp = -1, int i = -1) :
         color(c), specularExponent(spec), 
-        albedo(a),isBump(m), normalMap(nmp), image(i)  {}
-    Material() : color(), specularExponent(0), isBump(false),albedo(1,0,0,1) {}
+        albedo(a),isBump(m), normalMap(nmp), image(i), checkerColor(0.0f), checkerSize(0.0f)  {}
+    Material() : color(), specularExponent(0), isBump(false),albedo(1,0,0,1), normalMap(-1), image(-1), checkerColor(0.0f),
+        checkerSize(0.0f) {}
     Material(const Material& material)
     {
         copy(material);
@@ -27,14 +27,19 @@ public:
         albedo = m.albedo;
         normalMap = m.normalMap;
         image = m.image;
+        checkerColor = m.checkerColor;
+        checkerSize = m.checkerSize;
     }
 
     glm::vec4 albedo;
     glm::vec3 color;
     float specularExponent;
     bool isBump;
-    Image normalMap;
-    Image image;
+    int normalMap;
+    int image;
+    // checkerboard: cells of checkerSize alternate between color and checkerColor, 0 - plain colour
+    glm::vec3 checkerColor;
+    float checkerSize;
 
 };
 
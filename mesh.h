@@ -0,0 +1,666 @@
+#pragma once
+#ifndef __MESH__
+#define __MESH__
+
+#include "ray.h"
+#include "aabb.h"
+#include "material.h"
+#include "geometricObjects.h"
+#include "parallel.h"
+#include "alignedAllocator.h"
+#include <glm.hpp>
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstdint>
+
+struct MeshNode
+{
+	AABB bounds;
+	int first; // first child for inner nodes, first triangle for leaves
+	int count; // triangles of a leaf, 0 for inner nodes
+};
+
+// Four children in one cache line. The children's boxes are 8-bit coordinates on a grid over
+// the parent box whose cell size is a power of two per axis; they are rounded outwards, so a
+// box can only grow and never loses a triangle.
+struct alignas(64) QuantizedNode
+{
+	glm::vec3 origin; // minimum corner of the parent box
+	glm::vec3 scale; // grid cell size per axis
+	uint8_t lo[3][4]; // per axis and child
+	uint8_t hi[3][4];
+	int32_t child[4]; // >= 0 inner node, a leaf code from LeafCode(), kNoChild after the last child
+
+	AABB box(int c) const
+	{
+		return AABB(origin + glm::vec3(lo[0][c], lo[1][c], lo[2][c]) * scale, origin + glm::vec3(hi[0][c], hi[1][c], hi[2][c]) * scale);
+	}
+};
+
+static const int32_t kNoChild = -1;
+
+// leaves of a quantised node: the first triangle in the upper 27 bits, the count in the lower 4
+static inline int32_t LeafCode(int first, int count) { return ~((first << 4) | count); }
+static inline int LeafFirst(int32_t code) { return ~code >> 4; }
+static inline int LeafCount(int32_t code) { return ~code & 15; }
+
+// Triangle geometry: one vertex buffer shared by all triangles, three indices per triangle,
+// and a BVH over the triangles. build() puts the triangles in leaf order, so a leaf is a
+// contiguous run of them. Triangles are shaded flat and are visible from both sides.
+// compress() trades the binary tree for a four-wide one of QuantizedNodes in half the memory;
+// queries use whichever the mesh holds.
+class TriangleMesh
+{
+public:
+	// binned SAH build, large nodes are binned and subtrees built on all threads (threads <= 0)
+	void build(int threads = 0);
+	// replaces the built tree by its quantised four-wide form; meshes of 2^27 triangles or more
+	// keep the full one
+	void compress();
+
+	int triangleCount() const { return int(indices.size() / 3); }
+	AABB bounds() const { return box; }
+	bool compressed() const { return !packedNodes.empty(); }
+	size_t nodeBytes() const { return nodes.size() * sizeof(MeshNode) + packedNodes.size() * sizeof(QuantizedNode); }
+
+	// closest triangle nearer than tMax
+	bool closestHit(const Ray& ray, float tMax, float& tHit, int& triangle, TraversalStats* stats = nullptr) const;
+	bool occluded(const Ray& ray, float maxDist, TraversalStats* stats = nullptr) const;
+	glm::vec3 normal(int triangle) const;
+
+	std::string file; // the OBJ file it was loaded from
+	std::vector<glm::vec3> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<MeshNode> nodes;
+	AlignedVector<QuantizedNode> packedNodes; // the compressed tree, nodes is empty then
+
+	static const int maxLeafSize;
+	static const int binCount;
+	static const int maxBinnedDepth;
+
+private:
+	struct Bin
+	{
+		Bin() : count(0) {}
+		AABB bounds, centroids;
+		int count;
+	};
+	struct Builder;
+
+	int pack(int node);
+	bool hitTriangle(int triangle, const Ray& ray, float& t) const;
+	bool closestHitPacked(const Ray& ray, float tMax, float& tHit, int& triangle, TraversalStats* stats) const;
+	bool occludedPacked(const Ray& ray, float maxDist, TraversalStats* stats) const;
+
+	AABB box; // of all triangles
+};
+
+const int TriangleMesh::maxLeafSize = 8;
+const int TriangleMesh::binCount = 16;
+const int TriangleMesh::maxBinnedDepth = 48;
+
+// State shared by the build tasks. Nodes are preallocated for the largest possible tree, a
+// task takes the next pair of slots for the children of the node it splits.
+struct TriangleMesh::Builder
+{
+	std::vector<MeshNode>& nodes;
+	std::vector<int> order;
+	std::vector<AABB> boxes;
+	std::vector<glm::vec3> centers;
+	std::atomic<int> used;
+	int threads;
+
+	Builder(std::vector<MeshNode>& n, int t) : nodes(n), used(1), threads(t) {}
+
+	void bin(int first, int count, const AABB& centroids, int axis, Bin* bins, int threadCount) const;
+	void split(int node, const AABB& centroids, int depth);
+};
+
+void TriangleMesh::Builder::bin(int first, int count, const AABB& centroids, int axis, Bin* bins, int threadCount) const
+{
+	float scale = binCount / (centroids.max[axis] - centroids.min[axis]);
+	auto binOf = [&](int i) { return std::min(binCount - 1, int((centers[i][axis] - centroids.min[axis]) * scale)); };
+
+	// large ranges are binned in chunks on several threads, then the chunks are merged
+	int chunks = count >= (1 << 16) ? std::max(1, threadCount) : 1;
+	std::vector<Bin> partial(size_t(chunks) * binCount);
+	ParallelFor(count, chunks, [&](int begin, int end, int chunk)
+		{
+			Bin* local = &partial[size_t(chunk) * binCount];
+			for (int k = first + begin; k < first + end; k++)
+			{
+				Bin& b = local[binOf(order[k])];
+				b.bounds.grow(boxes[order[k]]);
+				b.centroids.grow(centers[order[k]]);
+				b.count++;
+			}
+		});
+	for (int c = 0; c < int(partial.size()) / binCount; c++)
+		for (int b = 0; b < binCount; b++)
+		{
+			bins[b].bounds.grow(partial[size_t(c) * binCount + b].bounds);
+			bins[b].centroids.grow(partial[size_t(c) * binCount + b].centroids);
+			bins[b].count += partial[size_t(c) * binCount + b].count;
+		}
+}
+
+void TriangleMesh::Builder::split(int node, const AABB& centroids, int depth)
+{
+	int first = nodes[node].first;
+	int count = nodes[node].count;
+	if (count <= 2)
+		return;
+
+	// the first levels have the threads to themselves, deeper ones share them
+	int threadCount = std::max(1, threads >> depth);
+
+	// cost of a split in units of triangle tests: one box test plus the triangles of both
+	// sides weighted by the chance of entering them
+	float bestCost = float(count);
+	int bestAxis = -1, bestSplit = 0;
+	Bin bestBins[binCount];
+	float area = nodes[node].bounds.area();
+	for (int axis = 0; axis < 3 && area > 0; axis++)
+	{
+		if (!(centroids.max[axis] > centroids.min[axis]))
+			continue;
+		Bin bins[binCount];
+		bin(first, count, centroids, axis, bins, threadCount);
+
+		// sweep from the right for the suffix costs, then from the left
+		float rightCost[binCount];
+		AABB right;
+		int rightCount = 0;
+		for (int b = binCount - 1; b > 0; b--)
+		{
+			right.grow(bins[b].bounds);
+			rightCount += bins[b].count;
+			rightCost[b] = right.area() * rightCount;
+		}
+		AABB left;
+		int leftCount = 0;
+		for (int b = 1; b < binCount; b++)
+		{
+			left.grow(bins[b - 1].bounds);
+			leftCount += bins[b - 1].count;
+			if (leftCount == 0 || leftCount == count)
+				continue;
+			float cost = 1.0f + (left.area() * leftCount + rightCost[b]) / area;
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b;
+				std::copy(bins, bins + binCount, bestBins);
+			}
+		}
+	}
+
+	// past maxBinnedDepth only median splits are made, so the depth stays bounded
+	bool binned = bestAxis >= 0 && depth < maxBinnedDepth;
+	int mid;
+	if (binned)
+	{
+		float scale = binCount / (centroids.max[bestAxis] - centroids.min[bestAxis]);
+		float lo = centroids.min[bestAxis];
+		mid = int(std::partition(order.begin() + first, order.begin() + first + count, [&](int i)
+			{
+				return std::min(binCount - 1, int((centers[i][bestAxis] - lo) * scale)) < bestSplit;
+			}) - order.begin());
+	}
+	else if (count > maxLeafSize)
+	{
+		// nothing worth a split, but too many triangles for a leaf
+		int axis = centroids.longestAxis();
+		mid = first + count / 2;
+		std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + first + count,
+			[&](int a, int b) { return centers[a][axis] < centers[b][axis]; });
+	}
+	else
+		return;
+
+	// the bins of a binned split already hold the bounds of both sides
+	AABB childBounds[2], childCentroids[2];
+	if (binned)
+		for (int b = 0; b < binCount; b++)
+		{
+			childBounds[b < bestSplit ? 0 : 1].grow(bestBins[b].bounds);
+			childCentroids[b < bestSplit ? 0 : 1].grow(bestBins[b].centroids);
+		}
+	else
+		for (int k = first; k < first + count; k++)
+		{
+			childBounds[k < mid ? 0 : 1].grow(boxes[order[k]]);
+			childCentroids[k < mid ? 0 : 1].grow(centers[order[k]]);
+		}
+
+	int left = used.fetch_add(2);
+	nodes[left] = { childBounds[0], first, mid - first };
+	nodes[left + 1] = { childBounds[1], mid, first + count - mid };
+	nodes[node].first = left;
+	nodes[node].count = 0;
+
+	// big subtrees are built concurrently while there are threads to spare
+	if (threadCount > 1 && count >= 4096)
+	{
+		std::thread task([&]() { split(left, childCentroids[0], depth + 1); });
+		split(left + 1, childCentroids[1], depth + 1);
+		task.join();
+	}
+	else
+	{
+		split(left, childCentroids[0], depth + 1);
+		split(left + 1, childCentroids[1], depth + 1);
+	}
+}
+
+void TriangleMesh::build(int threads)
+{
+	if (threads <= 0)
+		threads = std::max(1, int(std::thread::hardware_concurrency()));
+	nodes.clear();
+	packedNodes.clear();
+	box = AABB();
+	int count = triangleCount();
+	if (count == 0)
+		return;
+
+	// a binary tree with at most one triangle per leaf has fewer than 2 * count nodes
+	nodes.resize(2 * size_t(count));
+	Builder builder(nodes, threads);
+	builder.order.resize(count);
+	builder.boxes.resize(count);
+	builder.centers.resize(count);
+	std::vector<AABB> partialBounds(threads), partialCentroids(threads);
+	ParallelFor(count, threads, [&](int begin, int end, int chunk)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				AABB box;
+				for (int k = 0; k < 3; k++)
+					box.grow(vertices[indices[3 * i + k]]);
+				builder.order[i] = i;
+				builder.boxes[i] = box;
+				builder.centers[i] = (box.min + box.max) * 0.5f;
+				partialBounds[chunk].grow(box);
+				partialCentroids[chunk].grow(builder.centers[i]);
+			}
+		});
+
+	AABB bounds, centroids;
+	for (int c = 0; c < threads; c++)
+	{
+		bounds.grow(partialBounds[c]);
+		centroids.grow(partialCentroids[c]);
+	}
+	nodes[0] = { bounds, 0, count };
+	box = bounds;
+	builder.split(0, centroids, 0);
+	nodes.resize(builder.used);
+	nodes.shrink_to_fit();
+
+	// triangles in leaf order
+	std::vector<uint32_t> sorted(indices.size());
+	ParallelFor(count, threads, [&](int begin, int end, int)
+		{
+			for (int i = begin; i < end; i++)
+				for (int k = 0; k < 3; k++)
+					sorted[3 * i + k] = indices[3 * builder.order[i] + k];
+		});
+	indices.swap(sorted);
+}
+
+// One quantised node for a binary node: the inner child with the largest box is opened until
+// there are four children or only leaves. Returns its index in packedNodes.
+int TriangleMesh::pack(int node)
+{
+	int children[4];
+	int n = 0;
+	if (nodes[node].count > 0)
+		children[n++] = node; // a root leaf
+	else
+	{
+		children[n++] = nodes[node].first;
+		children[n++] = nodes[node].first + 1;
+		while (n < 4)
+		{
+			int widest = -1;
+			for (int c = 0; c < n; c++)
+				if (nodes[children[c]].count == 0 && (widest < 0 || nodes[children[c]].bounds.area() > nodes[children[widest]].bounds.area()))
+					widest = c;
+			if (widest < 0)
+				break;
+			int opened = children[widest];
+			children[widest] = nodes[opened].first;
+			children[n++] = nodes[opened].first + 1;
+		}
+	}
+
+	int index = int(packedNodes.size());
+	packedNodes.push_back(QuantizedNode());
+	QuantizedNode q;
+	AABB parent;
+	for (int c = 0; c < n; c++)
+		parent.grow(nodes[children[c]].bounds);
+	for (int a = 0; a < 3; a++)
+	{
+		// the smallest power of two that spans the parent in 255 cells
+		int exponent;
+		std::frexp((parent.max[a] - parent.min[a]) / 255.0f, &exponent);
+		float scale = std::ldexp(1.0f, exponent);
+		while (parent.min[a] + 255.0f * scale < parent.max[a])
+			scale *= 2.0f;
+		q.origin[a] = parent.min[a];
+		q.scale[a] = scale;
+		for (int c = 0; c < 4; c++)
+		{
+			q.lo[a][c] = q.hi[a][c] = 0;
+			if (c >= n)
+				continue;
+			// rounded outwards, then checked against the same float expression as AABB decoding
+			const AABB& b = nodes[children[c]].bounds;
+			int lo = std::max(0, std::min(255, int(std::floor((b.min[a] - q.origin[a]) / scale))));
+			while (lo > 0 && q.origin[a] + float(lo) * scale > b.min[a])
+				lo--;
+			int hi = std::max(0, std::min(255, int(std::ceil((b.max[a] - q.origin[a]) / scale))));
+			while (hi < 255 && q.origin[a] + float(hi) * scale < b.max[a])
+				hi++;
+			q.lo[a][c] = uint8_t(lo);
+			q.hi[a][c] = uint8_t(hi);
+		}
+	}
+
+	for (int c = 0; c < 4; c++)
+	{
+		if (c >= n)
+			q.child[c] = kNoChild;
+		else if (nodes[children[c]].count > 0)
+			q.child[c] = LeafCode(nodes[children[c]].first, nodes[children[c]].count);
+		else
+			q.child[c] = pack(children[c]);
+	}
+	packedNodes[index] = q;
+	return index;
+}
+
+void TriangleMesh::compress()
+{
+	if (nodes.empty() || triangleCount() >= (1 << 27))
+		return;
+	packedNodes.clear();
+	packedNodes.reserve(nodes.size() / 2 + 1);
+	pack(0);
+	packedNodes.shrink_to_fit();
+	std::vector<MeshNode>().swap(nodes);
+}
+
+// Moller-Trumbore
+bool TriangleMesh::hitTriangle(int triangle, const Ray& ray, float& t) const
+{
+	const glm::vec3& a = vertices[indices[3 * triangle]];
+	glm::vec3 e1 = vertices[indices[3 * triangle + 1]] - a;
+	glm::vec3 e2 = vertices[indices[3 * triangle + 2]] - a;
+	glm::vec3 p = glm::cross(ray.direction, e2);
+	float det = glm::dot(e1, p);
+	if (det == 0.0f)
+		return false;
+	float inv = 1.0f / det;
+	glm::vec3 s = ray.origin - a;
+	float u = glm::dot(s, p) * inv;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+	glm::vec3 q = glm::cross(s, e1);
+	float v = glm::dot(ray.direction, q) * inv;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+	t = glm::dot(e2, q) * inv;
+	return t > Sphere::eps;
+}
+
+glm::vec3 TriangleMesh::normal(int triangle) const
+{
+	const glm::vec3& a = vertices[indices[3 * triangle]];
+	return glm::normalize(glm::cross(vertices[indices[3 * triangle + 1]] - a, vertices[indices[3 * triangle + 2]] - a));
+}
+
+bool TriangleMesh::closestHit(const Ray& ray, float tMax, float& tHit, int& triangle, TraversalStats* stats) const
+{
+	if (compressed())
+		return closestHitPacked(ray, tMax, tHit, triangle, stats);
+	if (nodes.empty())
+		return false;
+
+	glm::vec3 invDir = 1.0f / ray.direction;
+	float best = tMax;
+	int bestTriangle = -1;
+	int boxTests = 1, triangleTests = 0, steps = 0;
+
+	// the depth of the tree is bounded by the median splits of the builder
+	struct Entry { int node; float t; };
+	Entry stack[128];
+	int top = 0;
+	float t;
+	if (nodes[0].bounds.hit(ray, invDir, best, t))
+		stack[top++] = { 0, t };
+
+	while (top > 0)
+	{
+		Entry entry = stack[--top];
+		if (entry.t > best * kBoxSlack)
+			continue;
+
+		steps++;
+		const MeshNode& node = nodes[entry.node];
+		if (node.count > 0)
+		{
+			for (int i = node.first; i < node.first + node.count; i++)
+				if (hitTriangle(i, ray, t) && (t < best || (t == best && i < bestTriangle)))
+				{
+					best = t;
+					bestTriangle = i;
+				}
+			triangleTests += node.count;
+			continue;
+		}
+
+		Entry children[2];
+		int hits = 0;
+		for (int c = 0; c < 2; c++)
+		{
+			boxTests++;
+			if (nodes[node.first + c].bounds.hit(ray, invDir, best, t))
+				children[hits++] = { node.first + c, t };
+		}
+		// the far child goes first so the near one is visited first
+		if (hits == 2 && children[0].t < children[1].t)
+			std::swap(children[0], children[1]);
+		for (int c = 0; c < hits; c++)
+			stack[top++] = children[c];
+	}
+
+	if (stats)
+	{
+		stats->nodes += boxTests;
+		stats->primitives += triangleTests;
+		stats->steps += steps;
+	}
+	if (bestTriangle < 0)
+		return false;
+	tHit = best;
+	triangle = bestTriangle;
+	return true;
+}
+
+bool TriangleMesh::occluded(const Ray& ray, float maxDist, TraversalStats* stats) const
+{
+	if (compressed())
+		return occludedPacked(ray, maxDist, stats);
+	if (nodes.empty())
+		return false;
+
+	glm::vec3 invDir = 1.0f / ray.direction;
+	int stack[128];
+	int top = 0;
+	stack[top++] = 0;
+	int boxTests = 0, triangleTests = 0, steps = 0;
+	bool blocked = false;
+
+	while (top > 0 && !blocked)
+	{
+		const MeshNode& node = nodes[stack[--top]];
+		boxTests++;
+		float t;
+		if (!node.bounds.hit(ray, invDir, maxDist, t))
+			continue;
+
+		steps++;
+		if (node.count > 0)
+		{
+			for (int i = node.first; i < node.first + node.count && !blocked; i++)
+			{
+				triangleTests++;
+				blocked = hitTriangle(i, ray, t) && t < maxDist;
+			}
+			continue;
+		}
+		stack[top++] = node.first + 1;
+		stack[top++] = node.first;
+	}
+
+	if (stats)
+	{
+		stats->nodes += boxTests;
+		stats->primitives += triangleTests;
+		stats->steps += steps;
+	}
+	return blocked;
+}
+
+bool TriangleMesh::closestHitPacked(const Ray& ray, float tMax, float& tHit, int& triangle, TraversalStats* stats) const
+{
+	glm::vec3 invDir = 1.0f / ray.direction;
+	float best = tMax;
+	int bestTriangle = -1;
+	int boxTests = 1, triangleTests = 0, steps = 0;
+
+	// up to three more entries per level of the four-wide tree
+	struct Entry { int32_t child; float t; };
+	Entry stack[256];
+	int top = 0;
+	float t;
+	if (box.hit(ray, invDir, best, t))
+		stack[top++] = { 0, t };
+
+	while (top > 0)
+	{
+		Entry entry = stack[--top];
+		if (entry.t > best * kBoxSlack)
+			continue;
+
+		steps++;
+		if (entry.child < 0)
+		{
+			int first = LeafFirst(entry.child), count = LeafCount(entry.child);
+			for (int i = first; i < first + count; i++)
+				if (hitTriangle(i, ray, t) && (t < best || (t == best && i < bestTriangle)))
+				{
+					best = t;
+					bestTriangle = i;
+				}
+			triangleTests += count;
+			continue;
+		}
+
+		// children that are hit, sorted far to near so the nearest is popped first
+		const QuantizedNode& node = packedNodes[entry.child];
+		Entry hits[4];
+		int n = 0;
+		for (int c = 0; c < 4 && node.child[c] != kNoChild; c++)
+		{
+			boxTests++;
+			if (!node.box(c).hit(ray, invDir, best, t))
+				continue;
+			int k = n++;
+			for (; k > 0 && hits[k - 1].t < t; k--)
+				hits[k] = hits[k - 1];
+			hits[k] = { node.child[c], t };
+		}
+		for (int c = 0; c < n; c++)
+			stack[top++] = hits[c];
+	}
+
+	if (stats)
+	{
+		stats->nodes += boxTests;
+		stats->primitives += triangleTests;
+		stats->steps += steps;
+	}
+	if (bestTriangle < 0)
+		return false;
+	tHit = best;
+	triangle = bestTriangle;
+	return true;
+}
+
+bool TriangleMesh::occludedPacked(const Ray& ray, float maxDist, TraversalStats* stats) const
+{
+	glm::vec3 invDir = 1.0f / ray.direction;
+	int32_t stack[256];
+	int top = 0;
+	int boxTests = 1, triangleTests = 0, steps = 0;
+	float t;
+	if (box.hit(ray, invDir, maxDist, t))
+		stack[top++] = 0;
+	bool blocked = false;
+
+	while (top > 0 && !blocked)
+	{
+		int32_t child = stack[--top];
+		steps++;
+		if (child < 0)
+		{
+			int first = LeafFirst(child), count = LeafCount(child);
+			for (int i = first; i < first + count && !blocked; i++)
+			{
+				triangleTests++;
+				blocked = hitTriangle(i, ray, t) && t < maxDist;
+			}
+			continue;
+		}
+
+		const QuantizedNode& node = packedNodes[child];
+		for (int c = 0; c < 4 && node.child[c] != kNoChild; c++)
+		{
+			boxTests++;
+			if (node.box(c).hit(ray, invDir, maxDist, t))
+				stack[top++] = node.child[c];
+		}
+	}
+
+	if (stats)
+	{
+		stats->nodes += boxTests;
+		stats->primitives += triangleTests;
+		stats->steps += steps;
+	}
+	return blocked;
+}
+
+// A triangle mesh placed in the scene with its material. The geometry is shared: copies and
+// other placements of the same file only hold another pointer to it.
+class Mesh
+{
+public:
+	Mesh(const std::shared_ptr<const TriangleMesh>& g, const Material& m) : geometry(g), material(m) {}
+
+	std::shared_ptr<const TriangleMesh> geometry;
+	Material material;
+};
+
+#endif // !__MESH__
@@ -0,0 +1,191 @@
+#pragma once
+#ifndef __OBJLOADER__
+#define __OBJLOADER__
+
+#include "mesh.h"
+#include "parallel.h"
+#include <glm.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+// Statements of one chunk of an OBJ file
+struct ObjChunk
+{
+	const char* begin;
+	const char* end;
+	int vertexBase; // vertices defined before the chunk
+	std::vector<glm::vec3> vertices;
+	std::vector<uint32_t> indices;
+	std::string error;
+};
+
+static const char* objSkipSpace(const char* p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		p++;
+	return p;
+}
+
+static const char* objNextLine(const char* p, const char* end)
+{
+	while (p < end && *p != '\n')
+		p++;
+	return p < end ? p + 1 : end;
+}
+
+static bool objIsVertex(const char* p, const char* end)
+{
+	return end - p > 1 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t');
+}
+
+// Parses the v and f statements of a chunk; faces are split into triangle fans. Texture
+// coordinates, normals, groups and materials are skipped.
+static void ParseObjChunk(ObjChunk& chunk)
+{
+	std::vector<uint32_t> face;
+	for (const char* p = chunk.begin; p < chunk.end; p = objNextLine(p, chunk.end))
+	{
+		p = objSkipSpace(p, chunk.end);
+		if (objIsVertex(p, chunk.end))
+		{
+			char* next;
+			glm::vec3 v;
+			v.x = strtof(p + 1, &next);
+			v.y = strtof(next, &next);
+			v.z = strtof(next, &next);
+			chunk.vertices.push_back(v);
+		}
+		else if (chunk.end - p > 1 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			face.clear();
+			p += 1;
+			while (true)
+			{
+				p = objSkipSpace(p, chunk.end);
+				if (p >= chunk.end || *p == '\n' || *p == '#')
+					break;
+				char* next;
+				long index = strtol(p, &next, 10);
+				if (next == p)
+				{
+					chunk.error = "bad face";
+					return;
+				}
+				// v, v/vt, v//vn or v/vt/vn: only the vertex is used; negative indices count back
+				// from the last vertex defined so far
+				long vertex = index > 0 ? index - 1 : chunk.vertexBase + long(chunk.vertices.size()) + index;
+				if (index == 0 || vertex < 0)
+				{
+					chunk.error = "bad vertex index";
+					return;
+				}
+				face.push_back(uint32_t(vertex));
+				p = next;
+				while (p < chunk.end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+					p++;
+			}
+			for (size_t k = 2; k < face.size(); k++)
+			{
+				chunk.indices.push_back(face[0]);
+				chunk.indices.push_back(face[k - 1]);
+				chunk.indices.push_back(face[k]);
+			}
+			p--; // back onto the line end for objNextLine
+		}
+	}
+}
+
+// Reads the triangles of a Wavefront OBJ file into mesh, without building its BVH. The file is
+// split into one chunk per thread at line ends. A first parallel pass counts the vertices of
+// every chunk, so the second one knows where each chunk's vertices start and resolves
+// relative indices on its own.
+bool LoadObj(const std::string& file, TriangleMesh& mesh, std::string& error, int threads = 0)
+{
+	FILE* f = fopen(file.c_str(), "rb");
+	if (!f)
+	{
+		error = "cannot open " + file;
+		return false;
+	}
+	std::vector<char> text;
+	char buffer[1 << 16];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		text.insert(text.end(), buffer, buffer + n);
+	fclose(f);
+	text.push_back('\n');
+	text.push_back('\0'); // strtof stops here at the latest
+	const char* begin = text.data();
+	const char* end = begin + text.size() - 1;
+
+	if (threads <= 0)
+		threads = std::max(1, int(std::thread::hardware_concurrency()));
+	// small files are not worth the threads
+	threads = std::max(1, std::min(threads, int(text.size() >> 20)));
+	std::vector<ObjChunk> chunks(threads);
+	for (int c = 0; c < threads; c++)
+	{
+		const char* p = begin + (end - begin) * c / threads;
+		chunks[c].begin = c == 0 ? begin : objNextLine(p - 1, end);
+	}
+	for (int c = 0; c < threads; c++)
+		chunks[c].end = c + 1 < threads ? chunks[c + 1].begin : end;
+
+	std::vector<int> vertexCounts(threads, 0);
+	ParallelFor(threads, threads, [&](int first, int last, int)
+		{
+			for (int c = first; c < last; c++)
+				for (const char* p = chunks[c].begin; p < chunks[c].end; p = objNextLine(p, chunks[c].end))
+					if (objIsVertex(objSkipSpace(p, chunks[c].end), chunks[c].end))
+						vertexCounts[c]++;
+		});
+	int vertexCount = 0;
+	for (int c = 0; c < threads; c++)
+	{
+		chunks[c].vertexBase = vertexCount;
+		vertexCount += vertexCounts[c];
+	}
+
+	ParallelFor(threads, threads, [&](int first, int last, int)
+		{
+			for (int c = first; c < last; c++)
+				ParseObjChunk(chunks[c]);
+		});
+
+	mesh.file = file;
+	mesh.vertices.clear();
+	mesh.indices.clear();
+	mesh.nodes.clear();
+	mesh.vertices.reserve(vertexCount);
+	for (auto& chunk : chunks)
+	{
+		if (!chunk.error.empty())
+		{
+			error = file + ": " + chunk.error;
+			return false;
+		}
+		mesh.vertices.insert(mesh.vertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+		mesh.indices.insert(mesh.indices.end(), chunk.indices.begin(), chunk.indices.end());
+		std::vector<glm::vec3>().swap(chunk.vertices);
+		std::vector<uint32_t>().swap(chunk.indices);
+	}
+	for (uint32_t index : mesh.indices)
+		if (index >= uint32_t(vertexCount))
+		{
+			error = file + ": vertex index out of range";
+			return false;
+		}
+	if (mesh.indices.empty())
+	{
+		error = file + ": no faces";
+		return false;
+	}
+	return true;
+}
+
+#endif // !__OBJLOADER__
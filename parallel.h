@@ -0,0 +1,34 @@
+#pragma once
+#ifndef __PARALLEL__
+#define __PARALLEL__
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+// Splits [0, count) into one contiguous chunk per thread and runs body(begin, end, chunk)
+// on each, the calling thread takes the first chunk. threads <= 0 uses every hardware thread.
+// Meant for the bulk loops of scene loading, rendering has its own tile scheduler.
+template <class F>
+void ParallelFor(int count, int threads, F&& body)
+{
+	if (threads <= 0)
+		threads = std::max(1, int(std::thread::hardware_concurrency()));
+	threads = std::max(1, std::min(threads, count));
+	if (threads == 1)
+	{
+		if (count > 0)
+			body(0, count, 0);
+		return;
+	}
+
+	auto bound = [count, threads](int chunk) { return int((long long)count * chunk / threads); };
+	std::vector<std::thread> workers;
+	for (int chunk = 1; chunk < threads; chunk++)
+		workers.emplace_back([&body, &bound, chunk]() { body(bound(chunk), bound(chunk + 1), chunk); });
+	body(0, bound(1), 0);
+	for (auto& worker : workers)
+		worker.join();
+}
+
+#endif // !__PARALLEL__
@@ -0,0 +1,142 @@
+#pragma once
+#ifndef __PFM__
+#define __PFM__
+
+#include <glm.hpp>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <utility>
+
+// 64 bit offsets, poster sized float images pass 2 GB
+static int pfmSeek(FILE* file, long long offset)
+{
+#ifdef _MSC_VER
+	return _fseeki64(file, offset, SEEK_SET);
+#else
+	return fseeko(file, off_t(offset), SEEK_SET);
+#endif
+}
+
+// Portable float map: a short text header followed by rgb float rows, bottom row first.
+// The layout is fixed, so rows can be written and read in any order by seeking.
+class PfmWriter
+{
+public:
+	PfmWriter() : file(nullptr), width(0), height(0), dataStart(0) {}
+	~PfmWriter() { close(); }
+
+	bool open(const std::string& path, int w, int h);
+	// rows [y0, y0 + rows) counted from the top of the image
+	bool writeRows(int y0, int rows, const glm::vec3* pixels);
+	bool close();
+
+private:
+	FILE* file;
+	int width, height;
+	long long dataStart;
+};
+
+bool PfmWriter::open(const std::string& path, int w, int h)
+{
+	file = fopen(path.c_str(), "wb");
+	if (!file)
+		return false;
+	width = w;
+	height = h;
+	// negative scale - little endian floats
+	fprintf(file, "PF\n%d %d\n-1.0\n", width, height);
+	dataStart = ftell(file);
+	return true;
+}
+
+bool PfmWriter::writeRows(int y0, int rows, const glm::vec3* pixels)
+{
+	if (!file)
+		return false;
+	std::vector<float> line(3 * width);
+	for (int j = y0; j < y0 + rows; j++)
+	{
+		const glm::vec3* p = pixels + (j - y0) * width;
+		for (int i = 0; i < width; i++)
+		{
+			line[3 * i] = p[i].r;
+			line[3 * i + 1] = p[i].g;
+			line[3 * i + 2] = p[i].b;
+		}
+		long long offset = dataStart + (long long)(height - 1 - j) * width * 3 * sizeof(float);
+		if (pfmSeek(file, offset) != 0 || fwrite(line.data(), sizeof(float), line.size(), file) != line.size())
+			return false;
+	}
+	return true;
+}
+
+bool PfmWriter::close()
+{
+	if (!file)
+		return true;
+	bool ok = fclose(file) == 0;
+	file = nullptr;
+	return ok;
+}
+
+class PfmReader
+{
+public:
+	PfmReader() : width(0), height(0), file(nullptr), dataStart(0), swapBytes(false) {}
+	~PfmReader() { if (file) fclose(file); }
+
+	bool open(const std::string& path);
+	// row j counted from the top of the image
+	bool readRow(int j, glm::vec3* pixels);
+
+	int width, height;
+
+private:
+	FILE* file;
+	long long dataStart;
+	bool swapBytes;
+	std::vector<float> line;
+};
+
+bool PfmReader::open(const std::string& path)
+{
+	file = fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+
+	char type[3] = {};
+	float scale;
+	// the header ends with a single whitespace character after the scale
+	if (fscanf(file, "%2s %d %d %f", type, &width, &height, &scale) != 4 || strcmp(type, "PF") != 0 ||
+		width <= 0 || height <= 0 || fgetc(file) == EOF)
+		return false;
+
+	dataStart = ftell(file);
+	unsigned int probe = 1;
+	bool littleEndianHost = *(unsigned char*)&probe == 1;
+	swapBytes = (scale < 0) != littleEndianHost;
+	line.resize(3 * width);
+	return true;
+}
+
+bool PfmReader::readRow(int j, glm::vec3* pixels)
+{
+	long long offset = dataStart + (long long)(height - 1 - j) * width * 3 * sizeof(float);
+	if (pfmSeek(file, offset) != 0 || fread(line.data(), sizeof(float), line.size(), file) != line.size())
+		return false;
+
+	if (swapBytes)
+		for (auto& value : line)
+		{
+			unsigned char* b = (unsigned char*)&value;
+			std::swap(b[0], b[3]);
+			std::swap(b[1], b[2]);
+		}
+	for (int i = 0; i < width; i++)
+		pixels[i] = glm::vec3(line[3 * i], line[3 * i + 1], line[3 * i + 2]);
+	return true;
+}
+
+#endif // !__PFM__
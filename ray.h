@@ -27,4 +27,15 @@ Ray& Ray::operator= (const Ray& rhs)
 	return (*this);
 }
 
+// Footprint of a ray for texture filtering: a cone of the given width at the ray origin,
+// widening by spread per unit of distance
+struct RayCone
+{
+	RayCone(float w = 0.0f, float s = 0.0f) : width(w), spread(s) {}
+	float at(float t) const { return width + spread * t; }
+
+	float width;
+	float spread;
+};
+
 #endif // !__RAY__
@@ -0,0 +1,496 @@
+#pragma once
+#ifndef __RAYPACKET__
+#define __RAYPACKET__
+
+#include "ray.h"
+#include "bvh.h"
+#include "sphereSoA.h"
+#include <glm.hpp>
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+
+static const int kMaxPacketSize = 16;
+
+// Up to kMaxPacketSize rays traced together through the BVH. Components are stored in
+// separate arrays, so one SIMD register holds a component of 8 rays. Rays of a packet
+// should be coherent: a shared origin or nearly parallel directions, like the primary
+// rays of neighbouring pixels or the shadow rays towards one light.
+struct RayPacket
+{
+	RayPacket() : size(0), coherent(false) {}
+
+	void clear() { size = 0; }
+	void add(const Ray& ray, float maxDist);
+	// call after the last add: pads the lanes of the last group of 8 and sets up the interval bounds
+	void finish();
+
+	Ray ray(int k) const { return Ray(glm::vec3(ox[k], oy[k], oz[k]), glm::vec3(dx[k], dy[k], dz[k])); }
+	uint32_t all() const { return (uint32_t(1) << size) - 1; }
+	// true if no ray of the packet can enter the box closer than maxDist
+	bool misses(const AABB& box, float maxDist) const;
+
+	alignas(32) float ox[kMaxPacketSize];
+	alignas(32) float oy[kMaxPacketSize];
+	alignas(32) float oz[kMaxPacketSize];
+	alignas(32) float dx[kMaxPacketSize];
+	alignas(32) float dy[kMaxPacketSize];
+	alignas(32) float dz[kMaxPacketSize];
+	alignas(32) float ix[kMaxPacketSize]; // inverse directions for the slab test
+	alignas(32) float iy[kMaxPacketSize];
+	alignas(32) float iz[kMaxPacketSize];
+	alignas(32) float tMax[kMaxPacketSize]; // closest hit so far, or the shadow ray length
+	int size;
+
+	// interval culling: every ray's origin and inverse direction lie in these bounds. Only
+	// valid when the direction signs agree per axis, otherwise the packet is tested ray by ray.
+	bool coherent;
+	glm::vec3 originMin, originMax;
+	glm::vec3 invMin, invMax;
+};
+
+void RayPacket::add(const Ray& ray, float maxDist)
+{
+	int k = size++;
+	ox[k] = ray.origin.x;
+	oy[k] = ray.origin.y;
+	oz[k] = ray.origin.z;
+	dx[k] = ray.direction.x;
+	dy[k] = ray.direction.y;
+	dz[k] = ray.direction.z;
+	glm::vec3 inv = 1.0f / ray.direction;
+	ix[k] = inv.x;
+	iy[k] = inv.y;
+	iz[k] = inv.z;
+	tMax[k] = maxDist;
+}
+
+void RayPacket::finish()
+{
+	coherent = false;
+	if (size == 0)
+		return;
+
+	// padding lanes repeat the last ray, they are masked out everywhere
+	for (int k = size; k % 8 != 0; k++)
+	{
+		ox[k] = ox[size - 1]; oy[k] = oy[size - 1]; oz[k] = oz[size - 1];
+		dx[k] = dx[size - 1]; dy[k] = dy[size - 1]; dz[k] = dz[size - 1];
+		ix[k] = ix[size - 1]; iy[k] = iy[size - 1]; iz[k] = iz[size - 1];
+		tMax[k] = tMax[size - 1];
+	}
+
+	originMin = originMax = glm::vec3(ox[0], oy[0], oz[0]);
+	invMin = invMax = glm::vec3(ix[0], iy[0], iz[0]);
+	for (int k = 1; k < size; k++)
+	{
+		glm::vec3 o(ox[k], oy[k], oz[k]), inv(ix[k], iy[k], iz[k]);
+		originMin = glm::min(originMin, o);
+		originMax = glm::max(originMax, o);
+		invMin = glm::min(invMin, inv);
+		invMax = glm::max(invMax, inv);
+	}
+	coherent = size > 1;
+	for (int a = 0; a < 3; a++)
+		coherent = coherent && ((invMin[a] > 0 && invMax[a] < std::numeric_limits<float>::infinity()) ||
+			(invMax[a] < 0 && invMin[a] > -std::numeric_limits<float>::infinity()));
+}
+
+bool RayPacket::misses(const AABB& box, float maxDist) const
+{
+	if (!coherent)
+		return false;
+
+	// bounds of (plane - origin) * inverse direction over the packet, for the near and the far slab
+	float entry = 0.0f, exit = maxDist;
+	for (int a = 0; a < 3; a++)
+	{
+		bool positive = invMin[a] > 0;
+		float nearPlane = positive ? box.min[a] : box.max[a];
+		float farPlane = positive ? box.max[a] : box.min[a];
+
+		float n0 = (nearPlane - originMax[a]) * invMin[a], n1 = (nearPlane - originMax[a]) * invMax[a];
+		float n2 = (nearPlane - originMin[a]) * invMin[a], n3 = (nearPlane - originMin[a]) * invMax[a];
+		float f0 = (farPlane - originMax[a]) * invMin[a], f1 = (farPlane - originMax[a]) * invMax[a];
+		float f2 = (farPlane - originMin[a]) * invMin[a], f3 = (farPlane - originMin[a]) * invMax[a];
+
+		entry = std::max(entry, std::min(std::min(n0, n1), std::min(n2, n3)));
+		exit = std::min(exit, std::max(std::max(f0, f1), std::max(f2, f3)));
+	}
+	return entry > exit;
+}
+
+// Rays of mask whose slab test against the box passes within [0, maxDist[k]], tEntry is the
+// nearest entry distance among them. Same arithmetic as AABB::hit.
+typedef uint32_t (*PacketBoxKernel)(const RayPacket& packet, uint32_t mask, const AABB& box, const float* maxDist, float& tEntry);
+// Closest hit among the store slots [begin, end) for the rays of mask, same rules as SphereKernel
+typedef void (*PacketSphereKernel)(const SphereSoA& spheres, int begin, int end, const RayPacket& packet, uint32_t mask,
+	float* tBest, int* index);
+// Rays of mask blocked by a shadow casting sphere of [begin, end) closer than maxDist[k]
+typedef uint32_t (*PacketOcclusionKernel)(const SphereSoA& spheres, int begin, int end, const RayPacket& packet, uint32_t mask,
+	const float* maxDist);
+
+struct PacketKernels
+{
+	PacketBoxKernel box;
+	PacketSphereKernel intersect;
+	PacketOcclusionKernel occluded;
+};
+
+uint32_t packetBoxScalar(const RayPacket& p, uint32_t mask, const AABB& box, const float* maxDist, float& tEntry)
+{
+	uint32_t hits = 0;
+	tEntry = std::numeric_limits<float>::max();
+	for (int k = 0; k < p.size; k++)
+	{
+		float t;
+		if ((mask >> k & 1) && box.hit(p.ray(k), glm::vec3(p.ix[k], p.iy[k], p.iz[k]), maxDist[k], t))
+		{
+			hits |= uint32_t(1) << k;
+			tEntry = std::min(tEntry, t);
+		}
+	}
+	return hits;
+}
+
+void packetSpheresScalar(const SphereSoA& s, int begin, int end, const RayPacket& p, uint32_t mask, float* tBest, int* index)
+{
+	for (int k = 0; k < p.size; k++)
+		if (mask >> k & 1)
+			intersectSpheresScalar(s, begin, end, p.ray(k), tBest[k], index[k]);
+}
+
+uint32_t packetOccludedScalar(const SphereSoA& s, int begin, int end, const RayPacket& p, uint32_t mask, const float* maxDist)
+{
+	uint32_t blocked = 0;
+	for (int k = 0; k < p.size; k++)
+		if ((mask >> k & 1) && occludedSpheresScalar(s, begin, end, p.ray(k), maxDist[k]))
+			blocked |= uint32_t(1) << k;
+	return blocked;
+}
+
+#ifdef SPHERE_SIMD_X86
+// Lanes are rays here: a box or sphere is broadcast and tested against 8 rays at once.
+// The operations and their operand order follow the scalar code, so the results are the same bit for bit.
+
+SPHERE_AVX2_TARGET
+static inline __m256 packetLanes(uint32_t bits)
+{
+	const __m256i lane = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(int(bits)), lane), lane));
+}
+
+SPHERE_AVX2_TARGET
+uint32_t packetBoxAVX2(const RayPacket& p, uint32_t mask, const AABB& box, const float* maxDist, float& tEntry)
+{
+	const __m256 minX = _mm256_set1_ps(box.min.x), minY = _mm256_set1_ps(box.min.y), minZ = _mm256_set1_ps(box.min.z);
+	const __m256 maxX = _mm256_set1_ps(box.max.x), maxY = _mm256_set1_ps(box.max.y), maxZ = _mm256_set1_ps(box.max.z);
+
+	uint32_t hits = 0;
+	tEntry = std::numeric_limits<float>::max();
+	alignas(32) float entry[8];
+	for (int g = 0; g < p.size; g += 8)
+	{
+		uint32_t bits = mask >> g & 0xff;
+		if (!bits)
+			continue;
+
+		__m256 ox = _mm256_load_ps(p.ox + g), oy = _mm256_load_ps(p.oy + g), oz = _mm256_load_ps(p.oz + g);
+		__m256 ix = _mm256_load_ps(p.ix + g), iy = _mm256_load_ps(p.iy + g), iz = _mm256_load_ps(p.iz + g);
+		__m256 t0x = _mm256_mul_ps(_mm256_sub_ps(minX, ox), ix), t1x = _mm256_mul_ps(_mm256_sub_ps(maxX, ox), ix);
+		__m256 t0y = _mm256_mul_ps(_mm256_sub_ps(minY, oy), iy), t1y = _mm256_mul_ps(_mm256_sub_ps(maxY, oy), iy);
+		__m256 t0z = _mm256_mul_ps(_mm256_sub_ps(minZ, oz), iz), t1z = _mm256_mul_ps(_mm256_sub_ps(maxZ, oz), iz);
+
+		// min/max take the second operand on NaN, like glm::min/max and std::min/max with swapped arguments
+		__m256 nearX = _mm256_min_ps(t1x, t0x), nearY = _mm256_min_ps(t1y, t0y), nearZ = _mm256_min_ps(t1z, t0z);
+		__m256 farX = _mm256_max_ps(t1x, t0x), farY = _mm256_max_ps(t1y, t0y), farZ = _mm256_max_ps(t1z, t0z);
+		__m256 tNear = _mm256_max_ps(_mm256_max_ps(_mm256_setzero_ps(), nearZ), _mm256_max_ps(nearY, nearX));
+		__m256 tFar = _mm256_min_ps(_mm256_min_ps(_mm256_load_ps(maxDist + g), farZ), _mm256_min_ps(farY, farX));
+
+		bits &= uint32_t(_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ)));
+		if (!bits)
+			continue;
+		hits |= bits << g;
+		_mm256_store_ps(entry, tNear);
+		for (int k = 0; k < 8; k++)
+			if (bits >> k & 1)
+				tEntry = std::min(tEntry, entry[k]);
+	}
+	return hits;
+}
+
+SPHERE_AVX2_TARGET
+void packetSpheresAVX2(const SphereSoA& s, int begin, int end, const RayPacket& p, uint32_t mask, float* tBest, int* index)
+{
+	const __m256 eps = _mm256_set1_ps(Sphere::eps);
+	const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+	for (int g = 0; g < p.size; g += 8)
+	{
+		uint32_t bits = mask >> g & 0xff;
+		if (!bits)
+			continue;
+
+		__m256 lanes = packetLanes(bits);
+		__m256 ox = _mm256_load_ps(p.ox + g), oy = _mm256_load_ps(p.oy + g), oz = _mm256_load_ps(p.oz + g);
+		__m256 dx = _mm256_load_ps(p.dx + g), dy = _mm256_load_ps(p.dy + g), dz = _mm256_load_ps(p.dz + g);
+		__m256 best = _mm256_loadu_ps(tBest + g);
+		__m256i bestIndex = _mm256_loadu_si256((const __m256i*)(index + g));
+
+		for (int i = begin; i < end; i++)
+		{
+			__m256 lx = _mm256_sub_ps(_mm256_set1_ps(s.centerX[i]), ox);
+			__m256 ly = _mm256_sub_ps(_mm256_set1_ps(s.centerY[i]), oy);
+			__m256 lz = _mm256_sub_ps(_mm256_set1_ps(s.centerZ[i]), oz);
+			__m256 r2 = _mm256_set1_ps(s.radius2[i]);
+
+			__m256 l2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, lx), _mm256_mul_ps(ly, ly)), _mm256_mul_ps(lz, lz));
+			__m256 tca = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, dx), _mm256_mul_ps(ly, dy)), _mm256_mul_ps(lz, dz));
+			__m256 d2 = _mm256_sub_ps(l2, _mm256_mul_ps(tca, tca));
+			__m256 inside = _mm256_and_ps(lanes, _mm256_cmp_ps(d2, r2, _CMP_LE_OQ));
+			if (_mm256_testz_ps(inside, inside))
+				continue;
+
+			__m256 thc = _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(r2, d2), _mm256_setzero_ps()));
+			__m256 plus = _mm256_add_ps(tca, thc);
+			__m256 minus = _mm256_sub_ps(tca, thc);
+			__m256 nearFirst = _mm256_cmp_ps(tca, thc, _CMP_LT_OQ);
+			__m256 tMin = _mm256_blendv_ps(minus, plus, nearFirst);
+			__m256 t2 = _mm256_blendv_ps(plus, minus, nearFirst);
+			tMin = _mm256_blendv_ps(tMin, t2, _mm256_cmp_ps(_mm256_and_ps(tMin, absMask), eps, _CMP_LT_OQ));
+
+			// equal distances go to the lower sphere id, as in the single ray kernels
+			__m256i id = _mm256_set1_epi32(s.id[i]);
+			__m256 closer = _mm256_or_ps(_mm256_cmp_ps(tMin, best, _CMP_LT_OQ), _mm256_and_ps(_mm256_cmp_ps(tMin, best, _CMP_EQ_OQ),
+				_mm256_castsi256_ps(_mm256_cmpgt_epi32(bestIndex, id))));
+			__m256 update = _mm256_and_ps(_mm256_and_ps(inside, _mm256_cmp_ps(tMin, eps, _CMP_GT_OQ)), closer);
+			best = _mm256_blendv_ps(best, tMin, update);
+			bestIndex = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(bestIndex), _mm256_castsi256_ps(id), update));
+		}
+		_mm256_storeu_ps(tBest + g, best);
+		_mm256_storeu_si256((__m256i*)(index + g), bestIndex);
+	}
+}
+
+SPHERE_AVX2_TARGET
+uint32_t packetOccludedAVX2(const SphereSoA& s, int begin, int end, const RayPacket& p, uint32_t mask, const float* maxDist)
+{
+	const __m256 eps = _mm256_set1_ps(Sphere::eps);
+	const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+	uint32_t blocked = 0;
+	for (int g = 0; g < p.size; g += 8)
+	{
+		uint32_t bits = mask >> g & 0xff;
+		if (!bits)
+			continue;
+
+		__m256 ox = _mm256_load_ps(p.ox + g), oy = _mm256_load_ps(p.oy + g), oz = _mm256_load_ps(p.oz + g);
+		__m256 dx = _mm256_load_ps(p.dx + g), dy = _mm256_load_ps(p.dy + g), dz = _mm256_load_ps(p.dz + g);
+		__m256 tMax = _mm256_loadu_ps(maxDist + g);
+
+		for (int i = begin; i < end && bits; i++)
+		{
+			if (!s.castsShadow[i])
+				continue;
+
+			__m256 lx = _mm256_sub_ps(_mm256_set1_ps(s.centerX[i]), ox);
+			__m256 ly = _mm256_sub_ps(_mm256_set1_ps(s.centerY[i]), oy);
+			__m256 lz = _mm256_sub_ps(_mm256_set1_ps(s.centerZ[i]), oz);
+			__m256 r2 = _mm256_set1_ps(s.radius2[i]);
+
+			__m256 l2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, lx), _mm256_mul_ps(ly, ly)), _mm256_mul_ps(lz, lz));
+			__m256 tca = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, dx), _mm256_mul_ps(ly, dy)), _mm256_mul_ps(lz, dz));
+			__m256 d2 = _mm256_sub_ps(l2, _mm256_mul_ps(tca, tca));
+			__m256 inside = _mm256_and_ps(packetLanes(bits), _mm256_cmp_ps(d2, r2, _CMP_LE_OQ));
+			if (_mm256_testz_ps(inside, inside))
+				continue;
+
+			__m256 thc = _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(r2, d2), _mm256_setzero_ps()));
+			__m256 plus = _mm256_add_ps(tca, thc);
+			__m256 minus = _mm256_sub_ps(tca, thc);
+			__m256 nearFirst = _mm256_cmp_ps(tca, thc, _CMP_LT_OQ);
+			__m256 tMin = _mm256_blendv_ps(minus, plus, nearFirst);
+			__m256 t2 = _mm256_blendv_ps(plus, minus, nearFirst);
+			tMin = _mm256_blendv_ps(tMin, t2, _mm256_cmp_ps(_mm256_and_ps(tMin, absMask), eps, _CMP_LT_OQ));
+
+			__m256 valid = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(tMin, eps, _CMP_GT_OQ), _mm256_cmp_ps(tMin, tMax, _CMP_LT_OQ)));
+			uint32_t hit = uint32_t(_mm256_movemask_ps(valid));
+			blocked |= hit << g;
+			bits &= ~hit; // blocked rays need no further tests
+		}
+	}
+	return blocked;
+}
+#endif
+
+PacketKernels selectPacketKernels(bool simd = true)
+{
+#ifdef SPHERE_SIMD_X86
+	if (simd && cpuSupportsAVX2())
+		return PacketKernels{ packetBoxAVX2, packetSpheresAVX2, packetOccludedAVX2 };
+#endif
+	return PacketKernels{ packetBoxScalar, packetSpheresScalar, packetOccludedScalar };
+}
+
+const PacketKernels& packetKernels()
+{
+	static const PacketKernels kernels = selectPacketKernels();
+	return kernels;
+}
+
+// Closest hit of every ray of the packet: the BVH is traversed once for the whole packet.
+// A node is skipped when the interval bounds of the packet miss it, otherwise the rays are
+// tested against it lane by lane and only those that hit it go on to its leaves. packet.tMax is
+// lowered to the closest hit distance; index, of kMaxPacketSize entries, stays -1 for rays that
+// hit nothing. primitive receives the triangle of mesh and instance hits.
+void PacketClosestHit(const BVH& bvh, const SphereSoA& spheres, const ShapeStore& shapes, RayPacket& packet, int* index,
+	int* primitive, TraversalStats* stats = nullptr, const PacketKernels& kernels = packetKernels())
+{
+	float* best = packet.tMax;
+	// the padding lanes of the last group of 8 are loaded and stored by the AVX2 kernel as well
+	for (int k = 0; k < kMaxPacketSize; k++)
+		index[k] = -1;
+	if (bvh.nodes.empty() || packet.size == 0)
+		return;
+
+	struct Entry { int node; float t; uint32_t mask; };
+	Entry stack[64];
+	int top = 0;
+	int boxTests = 1, primitiveTests = 0;
+
+	float t;
+	uint32_t mask = kernels.box(packet, packet.all(), bvh.nodes[0].bounds, best, t);
+	if (mask)
+		stack[top++] = { 0, t, mask };
+
+	while (top > 0)
+	{
+		Entry entry = stack[--top];
+		const BVHNode& node = bvh.nodes[entry.node];
+
+		// drop the rays that found something closer since the node was pushed
+		for (int k = 0; k < packet.size; k++)
+			if (entry.t > best[k])
+				entry.mask &= ~(uint32_t(1) << k);
+		if (!entry.mask)
+			continue;
+
+		if (node.count > 0)
+		{
+			const ShapeRange& leaf = bvh.leaves[node.first];
+			int sphereCount = leaf.count[int(ShapeKind::Sphere)];
+			if (sphereCount)
+				kernels.intersect(spheres, leaf.first[0], leaf.first[0] + sphereCount, packet, entry.mask, best, index);
+			// the other shapes are few and large, they are tested ray by ray
+			if (node.count > sphereCount)
+				for (int k = 0; k < packet.size; k++)
+					if (entry.mask >> k & 1)
+						shapes.intersect(leaf, packet.ray(k), best[k], index[k], primitive[k], stats);
+			primitiveTests += node.count;
+			continue;
+		}
+
+		float farthest = 0;
+		for (int k = 0; k < packet.size; k++)
+			if (entry.mask >> k & 1)
+				farthest = std::max(farthest, best[k]);
+
+		Entry children[2];
+		int hits = 0;
+		for (int c = 0; c < 2; c++)
+		{
+			const AABB& bounds = bvh.nodes[node.first + c].bounds;
+			boxTests++;
+			if (packet.misses(bounds, farthest))
+				continue;
+			uint32_t childMask = kernels.box(packet, entry.mask, bounds, best, t);
+			if (childMask)
+				children[hits++] = { node.first + c, t, childMask };
+		}
+
+		// the far child goes first so the near one is visited first
+		if (hits == 2 && children[0].t < children[1].t)
+			std::swap(children[0], children[1]);
+		for (int c = 0; c < hits; c++)
+			stack[top++] = children[c];
+	}
+
+	if (stats)
+	{
+		stats->nodes += boxTests;
+		stats->primitives += primitiveTests;
+	}
+}
+
+// Rays of mask that the objects of one BVH leaf node block, the node's box is not tested
+uint32_t PacketOccludedInLeaf(const BVH& bvh, int node, const SphereSoA& spheres, const ShapeStore& shapes,
+	const RayPacket& packet, uint32_t mask, TraversalStats* stats = nullptr, const PacketKernels& kernels = packetKernels())
+{
+	const ShapeRange& leaf = bvh.leaves[bvh.nodes[node].first];
+	int sphereCount = leaf.count[int(ShapeKind::Sphere)];
+	uint32_t blocked = 0;
+	if (sphereCount)
+		blocked = kernels.occluded(spheres, leaf.first[0], leaf.first[0] + sphereCount, packet, mask, packet.tMax);
+	if (bvh.nodes[node].count > sphereCount)
+		for (int k = 0; k < packet.size; k++)
+			if ((mask & ~blocked) >> k & 1 && shapes.occluded(leaf, packet.ray(k), packet.tMax[k], stats))
+				blocked |= uint32_t(1) << k;
+	return blocked;
+}
+
+// Any-hit query for a packet of shadow rays of lengths packet.tMax, returns the mask of the
+// blocked rays. Traversal ends as soon as every ray is blocked. occluder receives the last leaf
+// node that blocked a ray.
+uint32_t PacketOccluded(const BVH& bvh, const SphereSoA& spheres, const ShapeStore& shapes, const RayPacket& packet,
+	TraversalStats* stats = nullptr, const PacketKernels& kernels = packetKernels(), int* occluder = nullptr)
+{
+	if (bvh.nodes.empty() || packet.size == 0)
+		return 0;
+
+	float farthest = 0;
+	for (int k = 0; k < packet.size; k++)
+		farthest = std::max(farthest, packet.tMax[k]);
+
+	struct Entry { int node; uint32_t mask; };
+	Entry stack[64];
+	int top = 0;
+	stack[top++] = { 0, packet.all() };
+	uint32_t blocked = 0;
+	int boxTests = 0, primitiveTests = 0;
+
+	while (top > 0 && blocked != packet.all())
+	{
+		Entry entry = stack[--top];
+		const BVHNode& node = bvh.nodes[entry.node];
+		boxTests++;
+		float t;
+		if (packet.misses(node.bounds, farthest))
+			continue;
+		uint32_t mask = kernels.box(packet, entry.mask & ~blocked, node.bounds, packet.tMax, t);
+		if (!mask)
+			continue;
+
+		if (node.count > 0)
+		{
+			primitiveTests += node.count;
+			uint32_t hits = PacketOccludedInLeaf(bvh, entry.node, spheres, shapes, packet, mask & ~blocked, stats, kernels);
+			if (hits && occluder)
+				*occluder = entry.node;
+			blocked |= hits;
+			continue;
+		}
+
+		stack[top++] = { node.first + 1, mask };
+		stack[top++] = { node.first, mask };
+	}
+
+	if (stats)
+	{
+		stats->nodes += boxTests;
+		stats->primitives += primitiveTests;
+	}
+	return blocked;
+}
+
+#endif // !__RAYPACKET__
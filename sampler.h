@@ -0,0 +1,64 @@
+#pragma once
+#ifndef __SAMPLER__
+#define __SAMPLER__
+
+#include <glm.hpp>
+#include <cstdint>
+#include <cstring>
+
+// Small PCG32 generator for the Monte Carlo integrator. Every pixel sample gets its
+// own stream, so images do not depend on the thread or tile a pixel lands on.
+class Sampler
+{
+public:
+	Sampler(uint64_t pixel, uint64_t sample) : state(0), increment((pixel << 1u) | 1u)
+	{
+		nextUInt();
+		state += 0x853c49e6748fea9bULL + sample * 0x9e3779b97f4a7c15ULL;
+		nextUInt();
+	}
+
+	uint32_t nextUInt()
+	{
+		uint64_t old = state;
+		state = old * 6364136223846793005ULL + increment;
+		uint32_t xorshifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+		uint32_t rot = uint32_t(old >> 59u);
+		return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+	}
+
+	// uniform in [0, 1)
+	float next() { return (nextUInt() >> 8) * (1.0f / 16777216.0f); }
+
+	glm::vec3 inUnitBall()
+	{
+		glm::vec3 p;
+		do
+		{
+			p = glm::vec3(next(), next(), next()) * 2.0f - 1.0f;
+		} while (glm::dot(p, p) > 1.0f);
+		return p;
+	}
+
+	// seed derived from a ray, for deterministic sampling where no pixel sample is at hand
+	static uint64_t hash(const glm::vec3& a, const glm::vec3& b);
+
+private:
+	uint64_t state;
+	uint64_t increment;
+};
+
+uint64_t Sampler::hash(const glm::vec3& a, const glm::vec3& b)
+{
+	float values[6] = { a.x, a.y, a.z, b.x, b.y, b.z };
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (float value : values)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		h = (h ^ bits) * 0x100000001b3ULL;
+	}
+	return h;
+}
+
+#endif // !__SAMPLER__
@@ -4,18 +4,202 @@
 
 #include "geometricObjects.h"
 #include "light.h"
+#include "bvh.h"
+#include "mesh.h"
+#include "instance.h"
+#include "textureRegistry.h"
 #include <vector>
+#include <set>
+#include <cmath>
 #include <glm.hpp>
 
+// Objects are numbered across the primitive lists: spheres first, then planes, boxes, discs, meshes
+// and instances
 class Scene
 {
 public:
 	std::vector<Sphere> spheres;
+	std::vector<Plane> planes;
+	std::vector<Box> boxes;
+	std::vector<Disc> discs;
+	std::vector<Mesh> meshes; // with their BVHs built
+	std::vector<Instance> instances;
+	std::vector<Material> materials; // referenced by instances
 	std::vector<Light> lights;
+	TextureRegistry textures;
 
-	Scene() {}
-	Scene(const Scene& s) : spheres(s.spheres), lights(s.lights) { }
-	~Scene() { spheres.clear(); lights.clear(); }
+	// filled by build(): the light list split by type, in the original order
+	float ambientIntensity;
+	std::vector<Light> pointLights;
+	std::vector<Light> sphereLights;
+
+	BVH bvh;
+	SphereSoA sphereStore;
+	ShapeStore shapeStore;
+
+	Scene() : ambientIntensity(0) {}
+	Scene(const Scene& s) : spheres(s.spheres), planes(s.planes), boxes(s.boxes), discs(s.discs), meshes(s.meshes), instances(s.instances),
+		materials(s.materials), lights(s.lights),
+		textures(s.textures), ambientIntensity(s.ambientIntensity), pointLights(s.pointLights), sphereLights(s.sphereLights),
+		bvh(s.bvh), sphereStore(s.sphereStore), shapeStore(s.shapeStore) { }
+
+	int objectCount() const;
+	// objects of one type
+	int count(ShapeKind kind) const;
+	ShapeKind kind(int object) const;
+	// position of the object in the list of its type
+	int slot(int object) const;
+	const Material& material(int object) const;
+	// emissive objects show their own colour and cast no shadows
+	bool emissive(int object) const { return kind(object) == ShapeKind::Sphere && spheres[object].type == SphereType::LightSource; }
+	// spheres and sphere instances, the surfaces with texture coordinates
+	bool spherical(int object) const;
+	// mesh geometry of the mesh objects and instances, a mesh shared by several of them counts once
+	std::vector<const TriangleMesh*> meshGeometry() const;
+
+	// has to be called once the objects and lights are in place and before rendering
+	void build()
+	{
+		std::vector<AABB> bounds;
+		std::vector<glm::vec3> centers;
+		std::vector<ShapeKind> kinds;
+		glm::vec3 lo, hi;
+		for (auto& sphere : spheres)
+		{
+			bounds.push_back(AABB(sphere.center - glm::vec3(sphere.radius), sphere.center + glm::vec3(sphere.radius)));
+			centers.push_back(sphere.center);
+			kinds.push_back(ShapeKind::Sphere);
+		}
+		for (auto& plane : planes)
+		{
+			plane.bounds(lo, hi);
+			bounds.push_back(AABB(lo, hi));
+			// unbounded planes have no centre, they are split by their point
+			glm::vec3 center = (lo + hi) * 0.5f;
+			for (int a = 0; a < 3; a++)
+				if (!std::isfinite(center[a]))
+					center[a] = plane.point[a];
+			centers.push_back(center);
+			kinds.push_back(ShapeKind::Plane);
+		}
+		for (auto& box : boxes)
+		{
+			bounds.push_back(AABB(box.min, box.max));
+			centers.push_back((box.min + box.max) * 0.5f);
+			kinds.push_back(ShapeKind::Box);
+		}
+		for (auto& disc : discs)
+		{
+			disc.bounds(lo, hi);
+			bounds.push_back(AABB(lo, hi));
+			centers.push_back(disc.center);
+			kinds.push_back(ShapeKind::Disc);
+		}
+		for (auto& mesh : meshes)
+		{
+			AABB box = mesh.geometry->bounds();
+			bounds.push_back(box);
+			centers.push_back((box.min + box.max) * 0.5f);
+			kinds.push_back(ShapeKind::Mesh);
+		}
+		for (auto& instance : instances)
+		{
+			AABB box = instance.bounds();
+			bounds.push_back(box);
+			centers.push_back((box.min + box.max) * 0.5f);
+			kinds.push_back(ShapeKind::Instance);
+		}
+		bvh.build(bounds, centers, kinds);
+
+		std::vector<int> sphereOrder;
+		for (int object : bvh.indices)
+			if (object < int(spheres.size()))
+				sphereOrder.push_back(object);
+		sphereStore.build(spheres, sphereOrder);
+		shapeStore.build(planes, boxes, discs, meshes, instances, bvh.indices, int(spheres.size()));
+
+		ambientIntensity = 0;
+		pointLights.clear();
+		sphereLights.clear();
+		for (auto& light : lights)
+		{
+			if (light.type == LightType::Ambient)
+				ambientIntensity += light.intensity;
+			else if (light.type == LightType::Point)
+				pointLights.push_back(light);
+			else
+				sphereLights.push_back(light);
+		}
+	}
+	~Scene() { spheres.clear(); lights.clear(); pointLights.clear(); sphereLights.clear(); }
 };
 
+int Scene::count(ShapeKind kind) const
+{
+	switch (kind)
+	{
+	case ShapeKind::Sphere: return int(spheres.size());
+	case ShapeKind::Plane: return int(planes.size());
+	case ShapeKind::Box: return int(boxes.size());
+	case ShapeKind::Disc: return int(discs.size());
+	case ShapeKind::Mesh: return int(meshes.size());
+	default: return int(instances.size());
+	}
+}
+
+int Scene::objectCount() const
+{
+	int total = 0;
+	for (int k = 0; k < kShapeKinds; k++)
+		total += count(ShapeKind(k));
+	return total;
+}
+
+ShapeKind Scene::kind(int object) const
+{
+	int k = 0;
+	while (k + 1 < kShapeKinds && object >= count(ShapeKind(k)))
+		object -= count(ShapeKind(k++));
+	return ShapeKind(k);
+}
+
+int Scene::slot(int object) const
+{
+	int last = int(kind(object));
+	for (int k = 0; k < last; k++)
+		object -= count(ShapeKind(k));
+	return object;
+}
+
+bool Scene::spherical(int object) const
+{
+	ShapeKind k = kind(object);
+	return k == ShapeKind::Sphere || (k == ShapeKind::Instance && !instances[slot(object)].mesh);
+}
+
+std::vector<const TriangleMesh*> Scene::meshGeometry() const
+{
+	std::set<const TriangleMesh*> geometry;
+	for (auto& mesh : meshes)
+		geometry.insert(mesh.geometry.get());
+	for (auto& instance : instances)
+		if (instance.mesh)
+			geometry.insert(instance.mesh.get());
+	return std::vector<const TriangleMesh*>(geometry.begin(), geometry.end());
+}
+
+const Material& Scene::material(int object) const
+{
+	int i = slot(object);
+	switch (kind(object))
+	{
+	case ShapeKind::Sphere: return spheres[i].material;
+	case ShapeKind::Plane: return planes[i].material;
+	case ShapeKind::Box: return boxes[i].material;
+	case ShapeKind::Disc: return discs[i].material;
+	case ShapeKind::Mesh: return meshes[i].material;
+	default: return materials[instances[i].material];
+	}
+}
+
 #endif // !__SCENE__
@@ -0,0 +1,406 @@
+#pragma once
+#ifndef __SCENELOADER__
+#define __SCENELOADER__
+
+#include "scene.h"
+#include "settings.h"
+#include "image.h"
+#include "textureRegistry.h"
+#include "material.h"
+#include "light.h"
+#include "mesh.h"
+#include "objLoader.h"
+#include "instance.h"
+#include "stbi_image.h"
+#include <glm.hpp>
+#include <gtc/matrix_transform.hpp>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <memory>
+
+// Decodes an image file into the registry unless it is there already, -1 if it cannot be read
+int LoadTexture(TextureRegistry& textures, const std::string& file, TextureKind kind)
+{
+	int handle = textures.find(file, kind);
+	if (handle >= 0)
+		return handle;
+
+	int x, y, n;
+	unsigned char* pixels = stbi_load(file.c_str(), &x, &y, &n, 3);
+	if (!pixels)
+		return -1;
+	handle = textures.add(file, pixels, x, y, kind);
+	stbi_image_free(pixels);
+	return handle;
+}
+
+// Text scene description, one statement per line, '#' starts a comment:
+//
+//   resolution <width> <height>
+//   fov <vertical field of view in degrees>
+//   texture <name> <image file>
+//   material <name> <r g b> <specular exponent> <albedo x4> [<normal map texture> <colour texture>]
+//   material <name> <r g b> <specular exponent> <albedo x4> checker <r g b> <square size>
+//   sphere <x y z> <radius> <material> [emissive]
+//   plane <x y z> <normal x y z> <material> [<min x y z> <max x y z>]
+//   box <min x y z> <max x y z> <material>
+//   disc <x y z> <normal x y z> <radius> <material>
+//   mesh <OBJ file> <material>
+//   instance sphere <material> [<transform> ...]
+//   instance mesh <OBJ file> <material> [<transform> ...]
+//
+// An instance places the unit sphere or a mesh with a transform and shares the geometry and the
+// material with every other instance of them. Transforms apply in the order given:
+//   translate <x y z>, rotate <axis x y z> <degrees>, scale <x y z>
+//   light ambient <intensity>
+//   light point <x y z> <intensity>
+//   light sphere <x y z> <intensity> <radius> <samples>
+//
+// Resolution and field of view only set defaults, the command line overrides them. A plane
+// with bounds is cut to the rectangle they span across its normal.
+class SceneLoader
+{
+public:
+	bool load(const std::string& path, Scene& scene, RenderSettings& settings);
+
+	std::string error;
+
+private:
+	bool fail(const std::string& message);
+	bool parseLine(std::istringstream& line, const std::string& keyword, Scene& scene, RenderSettings& settings);
+	std::shared_ptr<const TriangleMesh> loadMesh(const std::string& file, BVHFormat format);
+	int materialId(const std::string& name, Scene& scene);
+
+	std::string path;
+	int lineNumber;
+	std::map<std::string, std::string> textureFiles; // decoded by the materials that use them
+	std::map<std::string, Material> materials;
+	std::map<std::string, std::shared_ptr<const TriangleMesh>> meshFiles; // a file is loaded once
+	std::map<std::string, int> materialIds; // entries of Scene::materials
+};
+
+bool SceneLoader::fail(const std::string& message)
+{
+	error = path + ":" + std::to_string(lineNumber) + ": " + message;
+	return false;
+}
+
+// The mesh of an OBJ file with its BVH in the given format, null after fail()
+std::shared_ptr<const TriangleMesh> SceneLoader::loadMesh(const std::string& file, BVHFormat format)
+{
+	if (!meshFiles.count(file))
+	{
+		std::shared_ptr<TriangleMesh> mesh = std::make_shared<TriangleMesh>();
+		std::string objError;
+		if (!LoadObj(file, *mesh, objError))
+		{
+			fail(objError);
+			return nullptr;
+		}
+		mesh->build();
+		if (format == BVHFormat::Compressed)
+			mesh->compress();
+		meshFiles[file] = mesh;
+	}
+	return meshFiles[file];
+}
+
+// Index of a material in Scene::materials, added on first use
+int SceneLoader::materialId(const std::string& name, Scene& scene)
+{
+	if (!materialIds.count(name))
+	{
+		materialIds[name] = int(scene.materials.size());
+		scene.materials.push_back(materials[name]);
+	}
+	return materialIds[name];
+}
+
+bool SceneLoader::load(const std::string& file, Scene& scene, RenderSettings& settings)
+{
+	path = file;
+	lineNumber = 0;
+	std::ifstream in(file);
+	if (!in)
+	{
+		error = "cannot open scene file " + file;
+		return false;
+	}
+
+	std::string text;
+	while (std::getline(in, text))
+	{
+		lineNumber++;
+		size_t comment = text.find('#');
+		if (comment != std::string::npos)
+			text.erase(comment);
+
+		std::istringstream line(text);
+		std::string keyword;
+		if (!(line >> keyword))
+			continue;
+		if (!parseLine(line, keyword, scene, settings))
+			return false;
+	}
+
+	scene.build();
+	return true;
+}
+
+bool SceneLoader::parseLine(std::istringstream& line, const std::string& keyword, Scene& scene, RenderSettings& settings)
+{
+	if (keyword == "resolution")
+	{
+		int w, h;
+		if (!(line >> w >> h) || w <= 0 || h <= 0)
+			return fail("expected: resolution <width> <height>");
+		settings.width = w;
+		settings.height = h;
+	}
+	else if (keyword == "fov")
+	{
+		float degrees;
+		if (!(line >> degrees) || degrees <= 0 || degrees >= 180)
+			return fail("expected: fov <degrees>");
+		settings.fov = glm::radians(degrees);
+	}
+	else if (keyword == "texture")
+	{
+		std::string name, file;
+		if (!(line >> name >> file))
+			return fail("expected: texture <name> <file>");
+		textureFiles[name] = file;
+	}
+	else if (keyword == "material")
+	{
+		std::string name;
+		glm::vec3 color;
+		float specular;
+		glm::vec4 albedo;
+		if (!(line >> name >> color.r >> color.g >> color.b >> specular >> albedo[0] >> albedo[1] >> albedo[2] >> albedo[3]))
+			return fail("expected: material <name> <r g b> <specular> <albedo x4> [<normal map> <texture> | checker <r g b> <size>]");
+
+		std::string normalMap, image;
+		if (line >> normalMap && normalMap == "checker")
+		{
+			Material checkered(color, specular, albedo);
+			if (!(line >> checkered.checkerColor.r >> checkered.checkerColor.g >> checkered.checkerColor.b >> checkered.checkerSize) ||
+				checkered.checkerSize <= 0)
+				return fail("expected: material " + name + " ... checker <r g b> <size>");
+			materials[name] = checkered;
+		}
+		else if (!normalMap.empty())
+		{
+			if (!(line >> image))
+				return fail("material " + name + ": a normal map needs a colour texture as well");
+			if (!textureFiles.count(normalMap) || !textureFiles.count(image))
+				return fail("material " + name + ": unknown texture");
+
+			int normalHandle = LoadTexture(scene.textures, textureFiles[normalMap], TextureKind::NormalMap);
+			if (normalHandle < 0)
+				return fail("cannot load texture " + textureFiles[normalMap]);
+			int imageHandle = LoadTexture(scene.textures, textureFiles[image], TextureKind::Color);
+			if (imageHandle < 0)
+				return fail("cannot load texture " + textureFiles[image]);
+			materials[name] = Material(color, specular, albedo, true, normalHandle, imageHandle);
+		}
+		else
+			materials[name] = Material(color, specular, albedo);
+	}
+	else if (keyword == "sphere")
+	{
+		glm::vec3 center;
+		float radius;
+		std::string material, tag;
+		if (!(line >> center.x >> center.y >> center.z >> radius >> material))
+			return fail("expected: sphere <x y z> <radius> <material> [emissive]");
+		if (!materials.count(material))
+			return fail("unknown material " + material);
+
+		SphereType type = SphereType::Regular;
+		if (line >> tag)
+		{
+			if (tag != "emissive")
+				return fail("unknown sphere flag " + tag);
+			type = SphereType::LightSource;
+		}
+		scene.spheres.push_back(Sphere(center, radius, materials[material], type));
+	}
+	else if (keyword == "plane")
+	{
+		glm::vec3 point, normal, lo, hi;
+		std::string material;
+		if (!(line >> point.x >> point.y >> point.z >> normal.x >> normal.y >> normal.z >> material) || normal == glm::vec3(0.0f))
+			return fail("expected: plane <x y z> <normal x y z> <material> [<min x y z> <max x y z>]");
+		if (!materials.count(material))
+			return fail("unknown material " + material);
+
+		if (line >> lo.x)
+		{
+			if (!(line >> lo.y >> lo.z >> hi.x >> hi.y >> hi.z))
+				return fail("expected: plane <x y z> <normal x y z> <material> [<min x y z> <max x y z>]");
+			scene.planes.push_back(Plane(point, normal, materials[material], glm::min(lo, hi), glm::max(lo, hi)));
+		}
+		else
+			scene.planes.push_back(Plane(point, normal, materials[material]));
+	}
+	else if (keyword == "box")
+	{
+		glm::vec3 lo, hi;
+		std::string material;
+		if (!(line >> lo.x >> lo.y >> lo.z >> hi.x >> hi.y >> hi.z >> material))
+			return fail("expected: box <min x y z> <max x y z> <material>");
+		if (!materials.count(material))
+			return fail("unknown material " + material);
+		scene.boxes.push_back(Box(lo, hi, materials[material]));
+	}
+	else if (keyword == "disc")
+	{
+		glm::vec3 center, normal;
+		float radius;
+		std::string material;
+		if (!(line >> center.x >> center.y >> center.z >> normal.x >> normal.y >> normal.z >> radius >> material) ||
+			normal == glm::vec3(0.0f) || radius <= 0)
+			return fail("expected: disc <x y z> <normal x y z> <radius> <material>");
+		if (!materials.count(material))
+			return fail("unknown material " + material);
+		scene.discs.push_back(Disc(center, normal, radius, materials[material]));
+	}
+	else if (keyword == "mesh")
+	{
+		std::string file, material;
+		if (!(line >> file >> material))
+			return fail("expected: mesh <OBJ file> <material>");
+		if (!materials.count(material))
+			return fail("unknown material " + material);
+
+		std::shared_ptr<const TriangleMesh> mesh = loadMesh(file, settings.bvhFormat);
+		if (!mesh)
+			return false;
+		scene.meshes.push_back(Mesh(mesh, materials[material]));
+	}
+	else if (keyword == "instance")
+	{
+		std::string type, file, material;
+		line >> type;
+		if (type == "mesh")
+			line >> file;
+		else if (type != "sphere")
+			return fail("expected: instance sphere|mesh ...");
+		if (!(line >> material))
+			return fail("expected: instance sphere <material> | instance mesh <OBJ file> <material>, then transforms");
+		if (!materials.count(material))
+			return fail("unknown material " + material);
+
+		glm::mat4 toWorld(1.0f);
+		std::string op;
+		while (line >> op)
+		{
+			glm::vec3 v;
+			float degrees;
+			if (!(line >> v.x >> v.y >> v.z))
+				return fail("expected: translate|rotate|scale <x y z>");
+			if (op == "translate")
+				toWorld = glm::translate(glm::mat4(1.0f), v) * toWorld;
+			else if (op == "rotate" && line >> degrees && v != glm::vec3(0.0f))
+				toWorld = glm::rotate(glm::mat4(1.0f), glm::radians(degrees), v) * toWorld;
+			else if (op == "scale" && v.x != 0 && v.y != 0 && v.z != 0)
+				toWorld = glm::scale(glm::mat4(1.0f), v) * toWorld;
+			else
+				return fail("bad transform " + op);
+		}
+
+		std::shared_ptr<const TriangleMesh> mesh;
+		if (type == "mesh" && !(mesh = loadMesh(file, settings.bvhFormat)))
+			return false;
+		scene.instances.push_back(Instance(mesh, toWorld, materialId(material, scene)));
+	}
+	else if (keyword == "light")
+	{
+		std::string type;
+		line >> type;
+		glm::vec3 position;
+		float intensity, radius;
+		int samples;
+		if (type == "ambient")
+		{
+			if (!(line >> intensity))
+				return fail("expected: light ambient <intensity>");
+			scene.lights.push_back(Light(glm::vec3(0), intensity, LightType::Ambient));
+		}
+		else if (type == "point")
+		{
+			if (!(line >> position.x >> position.y >> position.z >> intensity))
+				return fail("expected: light point <x y z> <intensity>");
+			scene.lights.push_back(Light(position, intensity, LightType::Point));
+		}
+		else if (type == "sphere")
+		{
+			if (!(line >> position.x >> position.y >> position.z >> intensity >> radius >> samples))
+				return fail("expected: light sphere <x y z> <intensity> <radius> <samples>");
+			scene.lights.push_back(Light(position, intensity, LightType::Sphere, radius, samples));
+		}
+		else
+			return fail("unknown light type " + type);
+	}
+	else
+		return fail("unknown statement " + keyword);
+
+	return true;
+}
+
+// A normal mapped material, the plain colour when one of its textures is missing
+static Material TexturedMaterial(const glm::vec3& color, float specular, const glm::vec4& albedo, int normalMap, int image)
+{
+	if (normalMap < 0 || image < 0)
+		return Material(color, specular, albedo);
+	return Material(color, specular, albedo, true, normalMap, image);
+}
+
+// The scene the renderer was written for, used when no scene file is given.
+// default.scene describes the same scene.
+void buildDefaultScene(Scene& scene)
+{
+	TextureRegistry& textures = scene.textures;
+	int barkNMP = LoadTexture(textures, "Bark_NRM.jpg", TextureKind::NormalMap);
+	int bark = LoadTexture(textures, "Bark.jpg", TextureKind::Color);
+	int wallNMP = LoadTexture(textures, "wallNMP.jpg", TextureKind::NormalMap);
+	int wall = LoadTexture(textures, "wall.jpg", TextureKind::Color);
+	int foilNMP = LoadTexture(textures, "foilNMP.jpg", TextureKind::NormalMap);
+	int foil = LoadTexture(textures, "foil.jpg", TextureKind::Color);
+
+	Material ivory(glm::vec3(0.4f, 0.4f, 0.3f), 50.0f,glm::vec4(0.6, 0.3, 0.1, 0.0));
+	Material redRubber(glm::vec3(0.3f, 0.1f, 0.1f), 10.0f, glm::vec4(0.9, 0.1, 0.0, 0.0));
+	// the textures are looked up in the working directory, spheres without them are plain
+	Material rock = TexturedMaterial(glm::vec3(0.5f, 0.48f, 0.48f), 10.0f, glm::vec4(0.9, 0.1, 0.0, 0.0), barkNMP, bark);
+	Material wallM = TexturedMaterial(glm::vec3(1.0f, 0.0f, 0.0f), 15.0f, glm::vec4(0.9, 0.1, 0.0, 0.0), wallNMP, wall);
+	Material foilM = TexturedMaterial(glm::vec3(0.0, 0.0, 0.0), 10.0f, glm::vec4(0.9, 0.4, 0.0, 0.0), foilNMP, foil);
+	Material mirror(glm::vec3(0.84f, 0.3f, 0.61f), 125.0f, glm::vec4(0.0, 0.9, 0.8, 0.0));
+	Material light(glm::vec3(0.9f, 0.9f, 0.9f), 0.0f, glm::vec4(1.0f,0.0f,0.0f,0.0f));
+	Material ground(glm::vec3(1.0f, 1.0f, 1.0f) * 0.3f, 0.0f, glm::vec4(1.0f, 0.0f, 0.1f, 1.0f));
+	ground.checkerColor = glm::vec3(0.39f, 0.11f, 0.79f) * 0.3f;
+	ground.checkerSize = 2.0f;
+
+	scene.spheres.push_back(Sphere(glm::vec3(-3, 0 ,-15), 2, ivory));
+	scene.spheres.push_back(Sphere(glm::vec3(-1.0f,-1.5f, -12), 2, rock));
+	scene.spheres.push_back(Sphere(glm::vec3(1.5, -0.5, -18), 3, redRubber));
+	scene.spheres.push_back(Sphere(glm::vec3(7, 5, -18), 4, mirror));
+	scene.spheres.push_back(Sphere(glm::vec3(-5.0f, 7.0f, -10.0f),0.5f, light, SphereType::LightSource));
+	scene.spheres.push_back(Sphere(glm::vec3(-9.0, 0.0, -13.0f), 2, wallM));
+	scene.spheres.push_back(Sphere(glm::vec3(8.0, 0.0, -10), 2.0f, foilM));
+
+	// the checkerboard floor
+	scene.planes.push_back(Plane(glm::vec3(0, -4, 0), glm::vec3(0, 1, 0), ground, glm::vec3(-30, -4, -50), glm::vec3(30, -4, 2)));
+
+	scene.lights.push_back(Light(glm::vec3(30, 50, -25),0.7f,LightType::Point));
+	scene.lights.push_back(Light(glm::vec3(30, 20, 30), 0.3f,LightType::Point));
+
+	scene.lights.push_back(Light(glm::vec3(-5.0f, 7.0f, -10.0f), 0.9f, LightType::Sphere, 0.5f, 8));
+
+	scene.lights.push_back(Light(glm::vec3(-10, 30, 30), 0.2f, LightType::Ambient));
+	scene.build();
+}
+
+#endif // !__SCENELOADER__
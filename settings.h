@@ -0,0 +1,73 @@
+#pragma once
+#ifndef __SETTINGS__
+#define __SETTINGS__
+
+#include "image.h"
+#include "toneMap.h"
+#include <glm.hpp>
+#include <gtc/constants.hpp>
+#include <string>
+#include <algorithm>
+#include <cmath>
+
+enum class Integrator
+{
+	Glossy, // fixed tree of 7 glossy reflections per bounce
+	Path // Monte Carlo, one sampled reflection per bounce
+};
+
+// node layout of the mesh BVHs
+enum class BVHFormat
+{
+	Full, // binary, float boxes
+	Compressed // four-wide cache line nodes with 8-bit boxes
+};
+
+struct RenderSettings
+{
+	int width = 4000;
+	int height = 2000;
+	float fov = glm::pi<float>() / 2; // vertical field of view in radians
+	std::string output = "out.jpg";
+	std::string hdrOutput; // linear radiance as PFM, empty - not written
+	ToneMap toneMap; // radiance to the 8 bit output
+	std::string heatmapOutput; // per pixel intersection work as an image, empty - not written
+	std::string gbufferFile; // primary hits kept between renders for incremental re-rendering, empty - off
+	int threads = 0; // 0 - one worker per hardware thread
+	int tileSize = 32;
+
+	int maxDepth = 3; // last bounce that is still traced
+	int maxRaysPerPixel = 400; // cap on traced segments, 400 is the full glossy tree for depth 3
+
+	Integrator integrator = Integrator::Glossy;
+	int samplesPerPixel = 16;
+	int rouletteDepth = 2; // bounce from which paths may be ended by Russian roulette
+	float glossiness = 0.02f; // radius of the normal perturbation of glossy reflections
+
+	// adaptive sampling for the path integrator, samplesPerPixel becomes the upper bound
+	bool adaptive = false;
+	int adaptiveMinSamples = 8; // first batch, and every further batch
+	float adaptiveThreshold = 0.01f; // standard error of the pixel luminance
+
+	int lightSamples = 0; // shadow rays per sphere light, 0 - use each light's own count
+	int packetSize = 8; // coherent rays traced together (glossy primary rays, shadow rays), 1 - one by one
+	bool shadowCache = true; // shadow rays try the last blocker of their light before the BVH
+	bool sortBatches = true; // glossy wavefronts: rays sorted by origin and direction, hits by material
+	TextureFilter textureFilter = TextureFilter::Trilinear;
+	BVHFormat bvhFormat = BVHFormat::Full; // chosen before the scene file is read, meshes are built while it loads
+
+	// angle between the primary rays of neighbouring pixels, the spread of their ray cones
+	float pixelAngle() const { return 2 * std::tan(fov / 2) / height; }
+
+	// quick look at a scene: a quarter of the resolution and far fewer rays per pixel
+	void applyPreview()
+	{
+		width = std::max(1, width / 4);
+		height = std::max(1, height / 4);
+		maxDepth = std::min(maxDepth, 2);
+		samplesPerPixel = std::max(1, samplesPerPixel / 4);
+		lightSamples = 2;
+	}
+};
+
+#endif // !__SETTINGS__
@@ -0,0 +1,179 @@
+#pragma once
+#ifndef __SHAPESTORE__
+#define __SHAPESTORE__
+
+#include "ray.h"
+#include "aabb.h"
+#include "geometricObjects.h"
+#include "mesh.h"
+#include "instance.h"
+#include <vector>
+
+// Primitives of one BVH leaf: a range of slots per type. Spheres index the sphere store,
+// the other types the arrays of the shape store.
+struct ShapeRange
+{
+	int first[kShapeKinds];
+	int count[kShapeKinds];
+};
+
+// Planes, boxes, discs, meshes and instances in BVH leaf order, one array per type, so a leaf
+// tests each type in its own loop instead of calling through an interface per primitive. id
+// maps a slot back to the scene object number. Meshes and instances descend into their own BVH.
+class ShapeStore
+{
+public:
+	// order holds scene object numbers; spheres in it are skipped, they live in the sphere store
+	void build(const std::vector<Plane>& planeList, const std::vector<Box>& boxList, const std::vector<Disc>& discList,
+		const std::vector<Mesh>& meshList, const std::vector<Instance>& instanceList, const std::vector<int>& order,
+		int sphereCount);
+
+	// nearest hit among the leaf's shapes, same rules as the sphere kernels; primitive receives the
+	// triangle when a mesh or an instance is hit, the work inside meshes is added to stats
+	bool intersect(const ShapeRange& leaf, const Ray& ray, float& tBest, int& index, int& primitive,
+		TraversalStats* stats = nullptr) const;
+	bool occluded(const ShapeRange& leaf, const Ray& ray, float maxDist, TraversalStats* stats = nullptr) const;
+
+	std::vector<Plane> planes;
+	std::vector<Box> boxes;
+	std::vector<Disc> discs;
+	std::vector<Mesh> meshes;
+	std::vector<Instance> instances;
+	std::vector<int> planeId, boxId, discId, meshId, instanceId;
+};
+
+void ShapeStore::build(const std::vector<Plane>& planeList, const std::vector<Box>& boxList, const std::vector<Disc>& discList,
+	const std::vector<Mesh>& meshList, const std::vector<Instance>& instanceList, const std::vector<int>& order,
+	int sphereCount)
+{
+	planes.clear();
+	boxes.clear();
+	discs.clear();
+	meshes.clear();
+	instances.clear();
+	planeId.clear();
+	boxId.clear();
+	discId.clear();
+	meshId.clear();
+	instanceId.clear();
+
+	int planeBase = sphereCount;
+	int boxBase = planeBase + int(planeList.size());
+	int discBase = boxBase + int(boxList.size());
+	int meshBase = discBase + int(discList.size());
+	int instanceBase = meshBase + int(meshList.size());
+	for (int object : order)
+	{
+		if (object >= instanceBase)
+		{
+			instances.push_back(instanceList[object - instanceBase]);
+			instanceId.push_back(object);
+		}
+		else if (object >= meshBase)
+		{
+			meshes.push_back(meshList[object - meshBase]);
+			meshId.push_back(object);
+		}
+		else if (object >= discBase)
+		{
+			discs.push_back(discList[object - discBase]);
+			discId.push_back(object);
+		}
+		else if (object >= boxBase)
+		{
+			boxes.push_back(boxList[object - boxBase]);
+			boxId.push_back(object);
+		}
+		else if (object >= planeBase)
+		{
+			planes.push_back(planeList[object - planeBase]);
+			planeId.push_back(object);
+		}
+	}
+}
+
+// one loop per type over its slots of the leaf
+template <class Shape>
+static inline bool intersectShapes(const std::vector<Shape>& shapes, const std::vector<int>& ids, int first, int count,
+	const Ray& ray, float& tBest, int& index)
+{
+	bool found = false;
+	for (int i = first; i < first + count; i++)
+	{
+		float t;
+		if (shapes[i].hit(ray, t) && (t < tBest || (t == tBest && ids[i] < index)))
+		{
+			tBest = t;
+			index = ids[i];
+			found = true;
+		}
+	}
+	return found;
+}
+
+template <class Shape>
+static inline bool occludedShapes(const std::vector<Shape>& shapes, int first, int count, const Ray& ray, float maxDist)
+{
+	for (int i = first; i < first + count; i++)
+	{
+		float t;
+		if (shapes[i].hit(ray, t) && t < maxDist)
+			return true;
+	}
+	return false;
+}
+
+bool ShapeStore::intersect(const ShapeRange& leaf, const Ray& ray, float& tBest, int& index, int& primitive,
+	TraversalStats* stats) const
+{
+	const int p = int(ShapeKind::Plane), b = int(ShapeKind::Box), d = int(ShapeKind::Disc), m = int(ShapeKind::Mesh);
+	const int n = int(ShapeKind::Instance);
+	bool found = intersectShapes(planes, planeId, leaf.first[p], leaf.count[p], ray, tBest, index);
+	found = intersectShapes(boxes, boxId, leaf.first[b], leaf.count[b], ray, tBest, index) || found;
+	found = intersectShapes(discs, discId, leaf.first[d], leaf.count[d], ray, tBest, index) || found;
+	// meshes and instances come last in the object numbering, a tie never goes to them
+	for (int i = leaf.first[m]; i < leaf.first[m] + leaf.count[m]; i++)
+	{
+		float t;
+		int triangle;
+		if (meshes[i].geometry->closestHit(ray, tBest, t, triangle, stats))
+		{
+			tBest = t;
+			index = meshId[i];
+			primitive = triangle;
+			found = true;
+		}
+	}
+	for (int i = leaf.first[n]; i < leaf.first[n] + leaf.count[n]; i++)
+	{
+		float t;
+		int triangle;
+		if (instances[i].hit(ray, tBest, t, triangle, stats))
+		{
+			tBest = t;
+			index = instanceId[i];
+			primitive = triangle;
+			found = true;
+		}
+	}
+	return found;
+}
+
+bool ShapeStore::occluded(const ShapeRange& leaf, const Ray& ray, float maxDist, TraversalStats* stats) const
+{
+	const int p = int(ShapeKind::Plane), b = int(ShapeKind::Box), d = int(ShapeKind::Disc), m = int(ShapeKind::Mesh);
+	const int n = int(ShapeKind::Instance);
+	if (occludedShapes(planes, leaf.first[p], leaf.count[p], ray, maxDist) ||
+		occludedShapes(boxes, leaf.first[b], leaf.count[b], ray, maxDist) ||
+		occludedShapes(discs, leaf.first[d], leaf.count[d], ray, maxDist))
+		return true;
+	for (int i = leaf.first[m]; i < leaf.first[m] + leaf.count[m]; i++)
+		if (meshes[i].geometry->occluded(ray, maxDist, stats))
+			return true;
+	for (int i = leaf.first[n]; i < leaf.first[n] + leaf.count[n]; i++)
+		if (instances[i].occluded(ray, maxDist, stats))
+			return true;
+	return false;
+}
+
+#endif // !__SHAPESTORE__
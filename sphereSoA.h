@@ -0,0 +1,297 @@
+#pragma once
+#ifndef __SPHERESOA__
+#define __SPHERESOA__
+
+#include "ray.h"
+#include "geometricObjects.h"
+#include "alignedAllocator.h"
+#include <glm.hpp>
+#include <vector>
+#include <limits>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SPHERE_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SPHERE_AVX2_TARGET
+#else
+#define SPHERE_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+class SphereSoA;
+
+// Nearest hit among the slots [begin, end) of the store. tBest and index are only
+// updated when a closer sphere is found (equal distances go to the lower index).
+typedef bool (*SphereKernel)(const SphereSoA& spheres, int begin, int end, const Ray& ray, float& tBest, int& index);
+// True as soon as a shadow casting sphere in [begin, end) is hit closer than maxDist
+typedef bool (*SphereOcclusionKernel)(const SphereSoA& spheres, int begin, int end, const Ray& ray, float maxDist);
+
+// Structure-of-arrays copy of the sphere geometry used by the intersection kernels.
+// Slots follow the order they are built in (the BVH leaf order), id maps a slot back
+// to Scene::spheres and so to the sphere's material.
+class SphereSoA
+{
+public:
+	SphereSoA();
+
+	void build(const std::vector<Sphere>& spheres, const std::vector<int>& order);
+	int size() const { return count; }
+
+	bool intersect(int begin, int end, const Ray& ray, float& tBest, int& index) const
+	{
+		return kernel(*this, begin, end, ray, tBest, index);
+	}
+	bool occluded(int begin, int end, const Ray& ray, float maxDist) const
+	{
+		return occlusionKernel(*this, begin, end, ray, maxDist);
+	}
+
+	AlignedVector<float> centerX;
+	AlignedVector<float> centerY;
+	AlignedVector<float> centerZ;
+	AlignedVector<float> radius2;
+	AlignedVector<int> id;
+	AlignedVector<int> castsShadow; // 0 for emissive spheres, all bits set otherwise
+
+	SphereKernel kernel;
+	SphereOcclusionKernel occlusionKernel;
+	static const int width;
+
+private:
+	int count;
+};
+
+const int SphereSoA::width = 8;
+
+bool intersectSpheresScalar(const SphereSoA& s, int begin, int end, const Ray& ray, float& tBest, int& index)
+{
+	bool found = false;
+	for (int i = begin; i < end; i++)
+	{
+		float lx = s.centerX[i] - ray.origin.x;
+		float ly = s.centerY[i] - ray.origin.y;
+		float lz = s.centerZ[i] - ray.origin.z;
+		float l2 = lx * lx + ly * ly + lz * lz;
+		float tca = lx * ray.direction.x + ly * ray.direction.y + lz * ray.direction.z;
+		float d2 = l2 - tca * tca;
+		if (d2 > s.radius2[i])
+			continue;
+
+		// same near/far selection as Sphere::hit
+		float thc = sqrtf(s.radius2[i] - d2);
+		float tMin = tca < thc ? tca + thc : tca - thc;
+		float t2 = tca < thc ? tca - thc : tca + thc;
+		if (std::fabs(tMin) < Sphere::eps) tMin = t2;
+		if (tMin <= Sphere::eps)
+			continue;
+
+		if (tMin < tBest || (tMin == tBest && s.id[i] < index))
+		{
+			tBest = tMin;
+			index = s.id[i];
+			found = true;
+		}
+	}
+	return found;
+}
+
+bool occludedSpheresScalar(const SphereSoA& s, int begin, int end, const Ray& ray, float maxDist)
+{
+	for (int i = begin; i < end; i++)
+	{
+		if (!s.castsShadow[i])
+			continue;
+
+		float lx = s.centerX[i] - ray.origin.x;
+		float ly = s.centerY[i] - ray.origin.y;
+		float lz = s.centerZ[i] - ray.origin.z;
+		float l2 = lx * lx + ly * ly + lz * lz;
+		float tca = lx * ray.direction.x + ly * ray.direction.y + lz * ray.direction.z;
+		float d2 = l2 - tca * tca;
+		if (d2 > s.radius2[i])
+			continue;
+
+		float thc = sqrtf(s.radius2[i] - d2);
+		float tMin = tca < thc ? tca + thc : tca - thc;
+		float t2 = tca < thc ? tca - thc : tca + thc;
+		if (std::fabs(tMin) < Sphere::eps) tMin = t2;
+		if (tMin > Sphere::eps && tMin < maxDist)
+			return true;
+	}
+	return false;
+}
+
+#ifdef SPHERE_SIMD_X86
+SPHERE_AVX2_TARGET
+bool intersectSpheresAVX2(const SphereSoA& s, int begin, int end, const Ray& ray, float& tBest, int& index)
+{
+	const __m256 ox = _mm256_set1_ps(ray.origin.x);
+	const __m256 oy = _mm256_set1_ps(ray.origin.y);
+	const __m256 oz = _mm256_set1_ps(ray.origin.z);
+	const __m256 dx = _mm256_set1_ps(ray.direction.x);
+	const __m256 dy = _mm256_set1_ps(ray.direction.y);
+	const __m256 dz = _mm256_set1_ps(ray.direction.z);
+	const __m256 eps = _mm256_set1_ps(Sphere::eps);
+	const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+	bool found = false;
+	alignas(32) float t[8];
+	for (int i = begin; i < end; i += 8)
+	{
+		// no fused multiply-add, so the lanes round exactly like the scalar kernel
+		__m256 lx = _mm256_sub_ps(_mm256_loadu_ps(&s.centerX[i]), ox);
+		__m256 ly = _mm256_sub_ps(_mm256_loadu_ps(&s.centerY[i]), oy);
+		__m256 lz = _mm256_sub_ps(_mm256_loadu_ps(&s.centerZ[i]), oz);
+		__m256 r2 = _mm256_loadu_ps(&s.radius2[i]);
+
+		__m256 l2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, lx), _mm256_mul_ps(ly, ly)), _mm256_mul_ps(lz, lz));
+		__m256 tca = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, dx), _mm256_mul_ps(ly, dy)), _mm256_mul_ps(lz, dz));
+		__m256 d2 = _mm256_sub_ps(l2, _mm256_mul_ps(tca, tca));
+		__m256 inside = _mm256_cmp_ps(d2, r2, _CMP_LE_OQ);
+
+		__m256 thc = _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(r2, d2), _mm256_setzero_ps()));
+		__m256 plus = _mm256_add_ps(tca, thc);
+		__m256 minus = _mm256_sub_ps(tca, thc);
+		__m256 nearFirst = _mm256_cmp_ps(tca, thc, _CMP_LT_OQ);
+		__m256 tMin = _mm256_blendv_ps(minus, plus, nearFirst);
+		__m256 t2 = _mm256_blendv_ps(plus, minus, nearFirst);
+		tMin = _mm256_blendv_ps(tMin, t2, _mm256_cmp_ps(_mm256_and_ps(tMin, absMask), eps, _CMP_LT_OQ));
+
+		__m256 valid = _mm256_and_ps(inside, _mm256_cmp_ps(tMin, eps, _CMP_GT_OQ));
+		int mask = _mm256_movemask_ps(valid);
+		if (end - i < 8)
+			mask &= (1 << (end - i)) - 1;
+		if (!mask)
+			continue;
+
+		_mm256_store_ps(t, tMin);
+		for (int k = 0; k < 8; k++)
+		{
+			if (!(mask & (1 << k)))
+				continue;
+			if (t[k] < tBest || (t[k] == tBest && s.id[i + k] < index))
+			{
+				tBest = t[k];
+				index = s.id[i + k];
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+SPHERE_AVX2_TARGET
+bool occludedSpheresAVX2(const SphereSoA& s, int begin, int end, const Ray& ray, float maxDist)
+{
+	const __m256 ox = _mm256_set1_ps(ray.origin.x);
+	const __m256 oy = _mm256_set1_ps(ray.origin.y);
+	const __m256 oz = _mm256_set1_ps(ray.origin.z);
+	const __m256 dx = _mm256_set1_ps(ray.direction.x);
+	const __m256 dy = _mm256_set1_ps(ray.direction.y);
+	const __m256 dz = _mm256_set1_ps(ray.direction.z);
+	const __m256 eps = _mm256_set1_ps(Sphere::eps);
+	const __m256 tMax = _mm256_set1_ps(maxDist);
+	const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+	for (int i = begin; i < end; i += 8)
+	{
+		__m256 lx = _mm256_sub_ps(_mm256_loadu_ps(&s.centerX[i]), ox);
+		__m256 ly = _mm256_sub_ps(_mm256_loadu_ps(&s.centerY[i]), oy);
+		__m256 lz = _mm256_sub_ps(_mm256_loadu_ps(&s.centerZ[i]), oz);
+		__m256 r2 = _mm256_loadu_ps(&s.radius2[i]);
+		__m256 shadow = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)&s.castsShadow[i]));
+
+		__m256 l2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, lx), _mm256_mul_ps(ly, ly)), _mm256_mul_ps(lz, lz));
+		__m256 tca = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, dx), _mm256_mul_ps(ly, dy)), _mm256_mul_ps(lz, dz));
+		__m256 d2 = _mm256_sub_ps(l2, _mm256_mul_ps(tca, tca));
+		__m256 inside = _mm256_and_ps(shadow, _mm256_cmp_ps(d2, r2, _CMP_LE_OQ));
+		if (_mm256_testz_ps(inside, inside))
+			continue;
+
+		__m256 thc = _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(r2, d2), _mm256_setzero_ps()));
+		__m256 plus = _mm256_add_ps(tca, thc);
+		__m256 minus = _mm256_sub_ps(tca, thc);
+		__m256 nearFirst = _mm256_cmp_ps(tca, thc, _CMP_LT_OQ);
+		__m256 tMin = _mm256_blendv_ps(minus, plus, nearFirst);
+		__m256 t2 = _mm256_blendv_ps(plus, minus, nearFirst);
+		tMin = _mm256_blendv_ps(tMin, t2, _mm256_cmp_ps(_mm256_and_ps(tMin, absMask), eps, _CMP_LT_OQ));
+
+		__m256 valid = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(tMin, eps, _CMP_GT_OQ), _mm256_cmp_ps(tMin, tMax, _CMP_LT_OQ)));
+		int mask = _mm256_movemask_ps(valid);
+		if (end - i < 8)
+			mask &= (1 << (end - i)) - 1;
+		if (mask)
+			return true;
+	}
+	return false;
+}
+
+bool cpuSupportsAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+SphereKernel selectSphereKernel()
+{
+#ifdef SPHERE_SIMD_X86
+	if (cpuSupportsAVX2())
+		return intersectSpheresAVX2;
+#endif
+	return intersectSpheresScalar;
+}
+
+SphereOcclusionKernel selectSphereOcclusionKernel()
+{
+#ifdef SPHERE_SIMD_X86
+	if (cpuSupportsAVX2())
+		return occludedSpheresAVX2;
+#endif
+	return occludedSpheresScalar;
+}
+
+SphereSoA::SphereSoA() : kernel(selectSphereKernel()), occlusionKernel(selectSphereOcclusionKernel()), count(0) {}
+
+void SphereSoA::build(const std::vector<Sphere>& spheres, const std::vector<int>& order)
+{
+	count = int(order.size());
+	// one extra vector of padding so the SIMD kernel can always load 8 lanes
+	size_t padded = order.size() + width;
+
+	centerX.assign(padded, 0.0f);
+	centerY.assign(padded, 0.0f);
+	centerZ.assign(padded, 0.0f);
+	radius2.assign(padded, -std::numeric_limits<float>::max());
+	id.assign(padded, -1);
+	castsShadow.assign(padded, 0);
+
+	for (int i = 0; i < count; i++)
+	{
+		const Sphere& sphere = spheres[order[i]];
+		centerX[i] = sphere.center.x;
+		centerY[i] = sphere.center.y;
+		centerZ[i] = sphere.center.z;
+		radius2[i] = sphere.radius * sphere.radius;
+		id[i] = order[i];
+		castsShadow[i] = sphere.type == SphereType::LightSource ? 0 : -1;
+	}
+}
+
+#endif // !__SPHERESOA__
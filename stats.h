@@ -0,0 +1,86 @@
+#pragma once
+#ifndef __STATS__
+#define __STATS__
+
+#include "bvh.h"
+#include "tileScheduler.h"
+#include <glm.hpp>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <ostream>
+#include <iomanip>
+
+// Work counters of one render worker. Every worker only updates its own copy, the
+// copies are summed once the frame is done.
+struct RenderStats
+{
+	RenderStats() : primaryRays(0), reflectionRays(0), shadowRays(0), textureLookups(0), shadowCacheLookups(0), shadowCacheHits(0) {}
+
+	void add(const RenderStats& s)
+	{
+		primaryRays += s.primaryRays;
+		reflectionRays += s.reflectionRays;
+		shadowRays += s.shadowRays;
+		textureLookups += s.textureLookups;
+		shadowCacheLookups += s.shadowCacheLookups;
+		shadowCacheHits += s.shadowCacheHits;
+		traversal.nodes += s.traversal.nodes;
+		traversal.primitives += s.traversal.primitives;
+		traversal.steps += s.traversal.steps;
+	}
+
+	uint64_t rays() const { return primaryRays + reflectionRays + shadowRays; }
+	// intersection work, the unit of the cost heatmap
+	uint64_t cost() const { return traversal.nodes + traversal.primitives; }
+
+	uint64_t primaryRays;
+	uint64_t reflectionRays; // reflection segments and path bounces
+	uint64_t shadowRays;
+	uint64_t textureLookups;
+	uint64_t shadowCacheLookups; // shadow queries (rays or packets) that tried their light's last blocker first
+	uint64_t shadowCacheHits; // ... and were blocked by it, without a traversal
+	TraversalStats traversal; // box and primitive tests
+};
+
+struct TileTime
+{
+	Tile tile;
+	double ms;
+	int worker;
+};
+
+// black - red - yellow - white, t in [0, 1]
+glm::vec3 HeatColor(float t)
+{
+	return glm::clamp(glm::vec3(3 * t, 3 * t - 1, 3 * t - 2), glm::vec3(0.0f), glm::vec3(1.0f));
+}
+
+void PrintSummary(std::ostream& out, const RenderStats& stats, std::vector<TileTime> tiles, double seconds, int threads)
+{
+	std::ios::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+	double m = 1e-6;
+	out << std::fixed << std::setprecision(2)
+		<< "time: " << seconds << " s on " << threads << " threads, " << stats.rays() * m / seconds << " Mrays/s" << std::endl
+		<< "rays: " << stats.primaryRays * m << " M primary, " << stats.reflectionRays * m << " M reflection, "
+		<< stats.shadowRays * m << " M shadow" << std::endl
+		<< "tests: " << stats.traversal.nodes * m << " M boxes, " << stats.traversal.primitives * m << " M primitives, "
+		<< stats.textureLookups * m << " M texture lookups" << std::endl;
+	if (stats.shadowCacheLookups > 0)
+		out << "shadow cache: " << 100.0 * stats.shadowCacheHits / stats.shadowCacheLookups << " % hits of "
+			<< stats.shadowCacheLookups * m << " M lookups" << std::endl;
+
+	size_t hottest = std::min<size_t>(5, tiles.size());
+	std::partial_sort(tiles.begin(), tiles.begin() + hottest, tiles.end(),
+		[](const TileTime& a, const TileTime& b) { return a.ms > b.ms; });
+	out << "hottest tiles:";
+	for (size_t i = 0; i < hottest; i++)
+		out << " (" << tiles[i].tile.x0 << ", " << tiles[i].tile.y0 << ") " << std::setprecision(1) << tiles[i].ms << " ms"
+			<< (i + 1 < hottest ? "," : "");
+	out << std::endl;
+	out.flags(flags);
+	out.precision(precision);
+}
+
+#endif // !__STATS__
@@ -0,0 +1,46 @@
+#pragma once
+#ifndef __TEXTUREREGISTRY__
+#define __TEXTUREREGISTRY__
+
+#include "image.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+
+// Owns the textures of a scene. Every file is converted once per kind, materials
+// refer to the textures by handle, -1 is no texture.
+class TextureRegistry
+{
+public:
+	// handle of a texture added before from the same file as the same kind, -1 if there is none
+	int find(const std::string& file, TextureKind kind) const;
+	// converts 8 bit rgb pixels, the caller keeps ownership of them
+	int add(const std::string& file, const unsigned char* pixels, int width, int height, TextureKind kind);
+
+	const Image& operator[](int handle) const { return textures[handle]; }
+	const std::string& file(int handle) const { return files[handle]; }
+	int size() const { return int(textures.size()); }
+
+private:
+	std::vector<Image> textures;
+	std::vector<std::string> files;
+	std::map<std::pair<std::string, TextureKind>, int> handles;
+};
+
+int TextureRegistry::find(const std::string& file, TextureKind kind) const
+{
+	auto it = handles.find(std::make_pair(file, kind));
+	return it == handles.end() ? -1 : it->second;
+}
+
+int TextureRegistry::add(const std::string& file, const unsigned char* pixels, int width, int height, TextureKind kind)
+{
+	int handle = int(textures.size());
+	textures.push_back(Image(pixels, width, height, kind));
+	files.push_back(file);
+	handles[std::make_pair(file, kind)] = handle;
+	return handle;
+}
+
+#endif // !__TEXTUREREGISTRY__
@@ -0,0 +1,123 @@
+#pragma once
+#ifndef __TILESCHEDULER__
+#define __TILESCHEDULER__
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <functional>
+#include <algorithm>
+
+struct Tile
+{
+	int x0, y0;
+	int x1, y1;
+};
+
+// Splits the framebuffer into tiles and runs them on a pool of workers.
+// Tiles are dealt to the workers' deques in turn, so the workers move down the image
+// together and rows are finished roughly top to bottom. A worker takes work from the
+// front of its own deque and, once that is empty, steals from the back of the others.
+class TileScheduler
+{
+public:
+	TileScheduler(int width, int height, int tileSize, int threadCount);
+
+	void run(const std::function<void(const Tile&, int)>& work);
+
+	int threads() const { return threadCount; }
+	size_t tileCount() const { return tiles.size(); }
+
+	static int defaultThreadCount();
+
+private:
+	struct WorkQueue
+	{
+		std::mutex mutex;
+		std::deque<Tile> tiles;
+	};
+
+	bool pop(int worker, Tile& tile);
+	bool steal(int worker, Tile& tile);
+	void workerLoop(int worker, const std::function<void(const Tile&, int)>& work);
+
+	std::vector<Tile> tiles;
+	std::vector<std::unique_ptr<WorkQueue>> queues;
+	int threadCount;
+};
+
+int TileScheduler::defaultThreadCount()
+{
+	unsigned int n = std::thread::hardware_concurrency();
+	return n == 0 ? 1 : int(n);
+}
+
+TileScheduler::TileScheduler(int width, int height, int tileSize, int threadCount)
+	: threadCount(threadCount > 0 ? threadCount : defaultThreadCount())
+{
+	tileSize = std::max(1, tileSize);
+	for (int y = 0; y < height; y += tileSize)
+		for (int x = 0; x < width; x += tileSize)
+			tiles.push_back({ x, y, std::min(x + tileSize, width), std::min(y + tileSize, height) });
+
+	this->threadCount = std::max(1, std::min<int>(this->threadCount, int(tiles.size())));
+	for (int i = 0; i < this->threadCount; i++)
+		queues.push_back(std::make_unique<WorkQueue>());
+}
+
+bool TileScheduler::pop(int worker, Tile& tile)
+{
+	WorkQueue& queue = *queues[worker];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.tiles.empty())
+		return false;
+
+	tile = queue.tiles.front();
+	queue.tiles.pop_front();
+	return true;
+}
+
+bool TileScheduler::steal(int worker, Tile& tile)
+{
+	for (int i = 1; i < threadCount; i++)
+	{
+		WorkQueue& victim = *queues[(worker + i) % threadCount];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tiles.empty())
+		{
+			tile = victim.tiles.back();
+			victim.tiles.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+void TileScheduler::workerLoop(int worker, const std::function<void(const Tile&, int)>& work)
+{
+	Tile tile;
+	// no tiles are added once the workers start, so a failed steal means we are done
+	while (pop(worker, tile) || steal(worker, tile))
+		work(tile, worker);
+}
+
+void TileScheduler::run(const std::function<void(const Tile&, int)>& work)
+{
+	for (auto& queue : queues)
+		queue->tiles.clear();
+	for (size_t i = 0; i < tiles.size(); i++)
+		queues[i % threadCount]->tiles.push_back(tiles[i]);
+
+	std::vector<std::thread> workers;
+	for (int i = 1; i < threadCount; i++)
+		workers.emplace_back(&TileScheduler::workerLoop, this, i, std::cref(work));
+
+	workerLoop(0, work);
+
+	for (auto& worker : workers)
+		worker.join();
+}
+
+#endif // !__TILESCHEDULER__
@@ -0,0 +1,41 @@
+#pragma once
+#ifndef __TONEMAP__
+#define __TONEMAP__
+
+#include <glm.hpp>
+#include <cmath>
+
+enum class ToneOperator
+{
+	Clamp, // cut off at 1, the look the renderer always had
+	Reinhard // x / (1 + x), keeps detail in highlights
+};
+
+// Maps linear radiance to display values in [0, 1] and quantises them to 8 bits.
+// With no exposure change the clamp operator reproduces the unmapped output exactly.
+struct ToneMap
+{
+	ToneMap(float stops = 0.0f, ToneOperator o = ToneOperator::Clamp) : exposure(stops), op(o) {}
+
+	glm::vec3 apply(const glm::vec3& radiance) const
+	{
+		glm::vec3 c = exposure == 0.0f ? radiance : radiance * std::exp2(exposure);
+		c = glm::max(c, glm::vec3(0.0f));
+		if (op == ToneOperator::Reinhard)
+			return c / (c + glm::vec3(1.0f));
+		return glm::min(c, glm::vec3(1.0f));
+	}
+
+	void quantise(const glm::vec3& radiance, unsigned char* rgb) const
+	{
+		glm::vec3 c = apply(radiance);
+		rgb[0] = (unsigned char)(255 * c.r);
+		rgb[1] = (unsigned char)(255 * c.g);
+		rgb[2] = (unsigned char)(255 * c.b);
+	}
+
+	float exposure; // in stops
+	ToneOperator op;
+};
+
+#endif // !__TONEMAP__
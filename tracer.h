@@ -0,0 +1,838 @@
+#pragma once
+#ifndef __TRACER__
+#define __TRACER__
+
+#include <glm.hpp>
+#include <gtc/constants.hpp>
+#include "scene.h"
+#include "ray.h"
+#include "material.h"
+#include "hit.h"
+#include "image.h"
+#include "settings.h"
+#include "sampler.h"
+#include "stats.h"
+#include "rayPacket.h"
+#include <algorithm>
+#include <vector>
+#include <utility>
+#include <tuple>
+#include <numeric>
+#include <limits>
+#include <cmath>
+
+// Ray tracing kernels shared by the renderer and the benchmark: intersection, lighting
+// and the two integrators. Output and scheduling live in main.cpp.
+
+static const float kInfinity = std::numeric_limits<float>::max();
+static const glm::vec3 kDefaultBackgroundColor = glm::vec3(0.235294, 0.67451, 0.843137);
+
+
+glm::vec3 reflect(const glm::vec3& I, const glm::vec3& N)
+{
+    return N * glm::dot(N, I) * 2.0f - I;
+}
+
+void getSphereTextureCoordinats(const glm::vec3& p, float& u, float& v) {
+    float r = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+    float phi = std::atan2(-p.z,p.x);
+    u = (phi + glm::pi<float>()) / (2 * glm::pi<float>());
+    float theta = glm::acos(-p.y / r);
+    v = theta / glm::pi<float>();
+}
+
+// Bit of a scene object in the masks of what a pixel's rays hit, objects share the 64 bits by number
+uint64_t ObjectBit(int object)
+{
+    return uint64_t(1) << (object % 64);
+}
+
+// Material and colour of a hit whose point, object, normal and texture coordinates are known.
+// Checkered materials alternate their two colours over squares across the normal.
+void ResolveMaterial(const Scene& scene, HitRecord& hit, TextureFilter filter)
+{
+    const Material& material = scene.material(hit.object);
+    hit.material = &material;
+    if (material.checkerSize > 0)
+    {
+        int a1, a2;
+        tangentAxes(dominantAxis(hit.normal), a1, a2);
+        hit.color = (int(hit.point[a1] / material.checkerSize + 1000) + int(hit.point[a2] / material.checkerSize)) & 1
+            ? material.color : material.checkerColor;
+    }
+    else if (material.isBump && scene.spherical(hit.object))
+        hit.color = scene.textures[material.image].sample(hit.uv.x, hit.uv.y, hit.footprint.x, hit.footprint.y, filter);
+    else
+        hit.color = material.color;
+}
+
+// Shading normal of a sphere hit from the centre-to-hit vector n of length radius: n itself, or
+// the normal map sample when the material has one, whose coordinates and footprint go into hit.
+// width is the ray cone width at the hit, in the same units as radius.
+glm::vec3 SphereShadingNormal(const Scene& scene, const Material& material, const glm::vec3& n, float radius,
+    const glm::vec3& direction, float width, HitRecord& hit, TextureFilter filter, RenderStats* stats)
+{
+    if (!material.isBump)
+        return glm::normalize(n);
+
+    float u, v;
+    getSphereTextureCoordinats(n, u, v);
+
+    // the footprint stretches on grazing hits; u covers the circumference of the
+    // latitude circle, v half a great circle
+    float cosine = std::max(0.1f, std::fabs(glm::dot(n, direction)) / radius);
+    float footprint = width / cosine;
+    float du = footprint / (2 * glm::pi<float>() * radius * std::max(0.01f, std::sin(v * glm::pi<float>())));
+    float dv = footprint / (glm::pi<float>() * radius);
+
+    // normal maps hold unit vectors, only filtered lookups need renormalising
+    if (stats)
+        stats->textureLookups += 2;
+    hit.uv = glm::vec2(u, v);
+    hit.footprint = glm::vec2(du, dv);
+    glm::vec3 normal = scene.textures[material.normalMap].sample(u, v, du, dv, filter);
+    return filter != TextureFilter::Nearest ? glm::normalize(normal) : normal;
+}
+
+// Completes a hit once the closest object is known (hit.t and hit.object, kInfinity and -1 for
+// none, and hit.primitive for meshes) and fills the shading data. Textures are filtered over the footprint of the ray cone
+// at the hit.
+bool ResolveHit(const Ray& ray, const Scene& scene, HitRecord& hit, const RayCone& cone, TextureFilter filter,
+    RenderStats* stats)
+{
+    if (hit.t >= 1000)
+        return false;
+
+    // shading data is only resolved for the closest hit
+    hit.point = ray.origin + ray.direction * hit.t;
+    hit.uv = hit.footprint = glm::vec2(0.0f);
+    ShapeKind kind = scene.kind(hit.object);
+    int slot = scene.slot(hit.object);
+    bool twoSided = kind == ShapeKind::Plane || kind == ShapeKind::Disc || kind == ShapeKind::Mesh;
+    switch (kind)
+    {
+    case ShapeKind::Sphere:
+    {
+        const Sphere& s = scene.spheres[slot];
+        hit.normal = SphereShadingNormal(scene, s.material, hit.point - s.center, s.radius, ray.direction, cone.at(hit.t),
+            hit, filter, stats);
+        break;
+    }
+    case ShapeKind::Box:
+        hit.normal = scene.boxes[slot].normalAt(hit.point);
+        break;
+    case ShapeKind::Plane:
+        hit.normal = scene.planes[slot].normal;
+        break;
+    case ShapeKind::Disc:
+        hit.normal = scene.discs[slot].normal;
+        break;
+    case ShapeKind::Mesh:
+    {
+        hit.normal = scene.meshes[slot].geometry->normal(hit.primitive);
+        break;
+    }
+    case ShapeKind::Instance:
+    {
+        // shaded in object space, the normal is taken back to world space
+        const Instance& instance = scene.instances[slot];
+        Ray local = instance.toObject(ray);
+        glm::vec3 normal;
+        if (!instance.mesh)
+            normal = SphereShadingNormal(scene, scene.materials[instance.material], local.origin + local.direction * hit.t,
+                1.0f, glm::normalize(local.direction), cone.at(hit.t) / instance.scale, hit, filter, stats);
+        else
+            normal = instance.mesh->normal(hit.primitive);
+        hit.normal = instance.normalToWorld(normal);
+        twoSided = instance.mesh != nullptr;
+        break;
+    }
+    }
+    // planes, discs and triangles are seen from both sides, the normal faces the ray
+    if (twoSided && glm::dot(hit.normal, ray.direction) > 0)
+        hit.normal = -hit.normal;
+    ResolveMaterial(scene, hit, filter);
+    return true;
+}
+
+// Closest hit along the ray. The work done is added to stats when it is given.
+bool SceneIntersect(const Ray& ray, const Scene& scene, HitRecord& hit, const RayCone& cone = RayCone(),
+    TextureFilter filter = TextureFilter::Nearest, RenderStats* stats = nullptr)
+{
+    hit.t = kInfinity;
+    hit.object = -1;
+    scene.bvh.closestHit(ray, scene.sphereStore, scene.shapeStore, hit.t, hit.object, hit.primitive,
+        stats ? &stats->traversal : nullptr);
+    return ResolveHit(ray, scene, hit, cone, filter, stats);
+}
+
+// Last blocker of every light's shadow rays, kept per worker: the scene BVH leaf that blocked
+// the light's most recent occluded query, -1 before the first. Neighbouring shading points are
+// mostly shadowed by the same object, so its leaf is tested before a full traversal.
+struct ShadowCache
+{
+    std::vector<int> leaf; // per light, point lights first, then sphere lights
+};
+
+// Any-hit query for shadow rays: true if something that casts a shadow lies closer than maxDist.
+// Emissive spheres are skipped and no shading data is computed. With lastOccluder, the leaf it
+// holds is tried first, and it is replaced by the leaf that blocks the ray in a traversal.
+bool Occluded(const Ray& ray, const Scene& scene, float maxDist, RenderStats* stats = nullptr, int* lastOccluder = nullptr)
+{
+    TraversalStats* traversal = stats ? &stats->traversal : nullptr;
+    if (stats)
+        stats->shadowRays++;
+    if (lastOccluder && *lastOccluder >= 0)
+    {
+        bool blocked = scene.bvh.occludedInLeaf(*lastOccluder, ray, scene.sphereStore, scene.shapeStore, maxDist, traversal);
+        if (stats)
+        {
+            stats->shadowCacheLookups++;
+            stats->shadowCacheHits += blocked;
+            stats->traversal.primitives += scene.bvh.nodes[*lastOccluder].count;
+        }
+        if (blocked)
+            return true;
+    }
+    return scene.bvh.occluded(ray, scene.sphereStore, scene.shapeStore, maxDist, traversal, lastOccluder);
+}
+
+// Occluded for a finished packet of shadow rays with lengths packet.tMax, returns the mask of blocked
+// rays. The last occluder only saves the traversal when it blocks every ray of the packet.
+uint32_t OccludedPacket(const RayPacket& packet, const Scene& scene, RenderStats* stats = nullptr, int* lastOccluder = nullptr)
+{
+    TraversalStats* traversal = stats ? &stats->traversal : nullptr;
+    if (stats)
+        stats->shadowRays += packet.size;
+    if (lastOccluder && *lastOccluder >= 0)
+    {
+        uint32_t blocked = PacketOccludedInLeaf(scene.bvh, *lastOccluder, scene.sphereStore, scene.shapeStore, packet,
+            packet.all(), traversal);
+        if (stats)
+        {
+            stats->shadowCacheLookups++;
+            stats->shadowCacheHits += blocked == packet.all();
+            stats->traversal.primitives += scene.bvh.nodes[*lastOccluder].count;
+        }
+        if (blocked == packet.all())
+            return blocked;
+    }
+    return PacketOccluded(scene.bvh, scene.sphereStore, scene.shapeStore, packet, traversal, packetKernels(), lastOccluder);
+}
+
+// Diffuse and Cook-Torrance style specular terms for the light direction l
+void LightTerms(const glm::vec3& normal, const glm::vec3& lightDir, const glm::vec3& v, float& diffuse, float& specular)
+{
+    float nl = glm::dot(normal, lightDir);
+    diffuse = std::max(0.0f, nl);
+
+    glm::vec3 h = glm::normalize(lightDir + v);
+    float nh = glm::dot(normal, h);
+    float nv = glm::dot(normal, v);
+    float sigma = glm::pow(0.3, 2.0f);
+    float d = sigma / (glm::pi<float>() * glm::pow(nh * nh * (sigma - 1) + 1, 2.0f));
+    float f = glm::clamp(std::fabs(nv), 0.1f, 0.9f);
+    float k = 2 * nh / glm::dot(h, v);
+    float g = std::min(1.0f, std::min(k * nv, k * nl));
+    float ct = d * f * g / (glm::pi<float>() * nv * nl);
+    specular = std::max(0.0f, ct);
+}
+
+// Samples a direction inside the cone subtended by a sphere light, uniformly in solid angle.
+// dist is the distance to the near side of the light along the sampled direction.
+glm::vec3 SampleSphereLight(const Light& light, const glm::vec3& p, float u1, float u2, float& dist)
+{
+    glm::vec3 toCenter = light.position - p;
+    float centerDist2 = glm::dot(toCenter, toCenter);
+    float centerDist = std::sqrt(centerDist2);
+    glm::vec3 w = toCenter / centerDist;
+    if (centerDist <= light.radius)
+    {
+        dist = centerDist;
+        return w;
+    }
+
+    float sinMax2 = light.radius * light.radius / centerDist2;
+    float cosMax = std::sqrt(std::max(0.0f, 1.0f - sinMax2));
+    float cosTheta = 1.0f - u1 * (1.0f - cosMax);
+    float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    float phi = 2.0f * glm::pi<float>() * u2;
+
+    glm::vec3 u = glm::normalize(glm::cross(std::fabs(w.x) > 0.1f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0), w));
+    glm::vec3 v = glm::cross(w, u);
+    glm::vec3 dir = glm::normalize(u * (std::cos(phi) * sinTheta) + v * (std::sin(phi) * sinTheta) + w * cosTheta);
+
+    float b = glm::dot(dir, toCenter);
+    dist = b - std::sqrt(std::max(0.0f, b * b - centerDist2 + light.radius * light.radius));
+    return dir;
+}
+
+void Lighting(const Scene& scene, const RenderSettings& settings, const glm::vec3& normal, const glm::vec3& hitPoint,
+    const glm::vec3& v,const float& specularExp,float& diffuse, float& specular, float& back, Sampler& sampler,
+    RenderStats* stats = nullptr, ShadowCache* shadowCache = nullptr)
+{
+    back += scene.ambientIntensity;
+
+    size_t lightCount = scene.pointLights.size() + scene.sphereLights.size();
+    if (!settings.shadowCache)
+        shadowCache = nullptr;
+    else if (shadowCache && shadowCache->leaf.size() != lightCount)
+        shadowCache->leaf.assign(lightCount, -1);
+    int lightIndex = 0;
+
+    for (auto& light : scene.pointLights)
+    {
+        int* lastOccluder = shadowCache ? &shadowCache->leaf[lightIndex++] : nullptr;
+        glm::vec3 lightDir = glm::normalize(light.position - hitPoint);
+        float lightDistance = glm::length(light.position - hitPoint);
+        
+        glm::vec3 shadowOrig = glm::dot(lightDir, normal) < 0 ? hitPoint - normal * 1e-3f : hitPoint + normal * 1e-3f;
+        glm::vec3 shadowDir = glm::normalize(light.position - hitPoint);
+
+        // the light is blocked as soon as one of the jittered shadow rays is
+        static const float jitter[] = { 0.0f, 0.01f, -0.01f, 0.02f, -0.02f };
+        bool occluded = false;
+        if (settings.packetSize > 1)
+        {
+            // the jittered rays share their origin, packets of them go through the BVH together
+            RayPacket packet;
+            for (int k = 0; k < 5 && !occluded; k += settings.packetSize)
+            {
+                packet.clear();
+                for (int r = k; r < std::min(5, k + settings.packetSize); r++)
+                    packet.add(Ray(shadowOrig, glm::normalize(shadowDir + glm::vec3(jitter[r]))), lightDistance);
+                packet.finish();
+                occluded = OccludedPacket(packet, scene, stats, lastOccluder) != 0;
+            }
+        }
+        else
+            for (float offset : jitter)
+            {
+                if (Occluded(Ray(shadowOrig, glm::normalize(shadowDir + glm::vec3(offset))), scene, lightDistance, stats,
+                    lastOccluder))
+                {
+                    occluded = true;
+                    break;
+                }
+            }
+
+        if (!occluded)
+        {
+            float d, s;
+            LightTerms(normal, lightDir, v, d, s);
+            diffuse += d * light.intensity;
+            specular += light.intensity * s;
+        }
+    }
+
+    // soft shadows: the light's intensity is spread over stratified samples of its solid angle,
+    // occluded samples simply do not contribute
+    for (auto& light : scene.sphereLights)
+    {
+        int* lastOccluder = shadowCache ? &shadowCache->leaf[lightIndex++] : nullptr;
+        int samples = settings.lightSamples > 0 ? settings.lightSamples : std::max(1, light.samples);
+        glm::vec3 centerDir = light.position - hitPoint;
+        glm::vec3 shadowOrig = glm::dot(centerDir, normal) < 0 ? hitPoint - normal * 1e-3f : hitPoint + normal * 1e-3f;
+        float weight = light.intensity / samples;
+        float offset = sampler.next();
+
+        // samples are drawn a packet at a time, in the same order as one by one
+        int packetSize = std::max(1, settings.packetSize);
+        RayPacket packet;
+        glm::vec3 lightDirs[kMaxPacketSize];
+        for (int first = 0; first < samples; first += packetSize)
+        {
+            int count = std::min(packetSize, samples - first);
+            packet.clear();
+            for (int k = first; k < first + count; k++)
+            {
+                float u1 = (k + sampler.next()) / samples;
+                float u2 = k * 0.618034f + offset;
+                float dist;
+                lightDirs[k - first] = SampleSphereLight(light, shadowOrig, u1, u2 - std::floor(u2), dist);
+                packet.add(Ray(shadowOrig, lightDirs[k - first]), dist);
+            }
+
+            uint32_t blocked = 0;
+            if (packetSize > 1)
+            {
+                packet.finish();
+                blocked = OccludedPacket(packet, scene, stats, lastOccluder);
+            }
+            else if (Occluded(packet.ray(0), scene, packet.tMax[0], stats, lastOccluder))
+                blocked = 1;
+
+            for (int k = 0; k < count; k++)
+            {
+                if (blocked >> k & 1)
+                    continue;
+                float d, s;
+                LightTerms(normal, lightDirs[k], v, d, s);
+                diffuse += d * weight;
+                specular += weight * s;
+            }
+        }
+    }
+}
+
+// One ray of the reflection tree. Segments are stored breadth first, so children always
+// follow their parent and the tree can be resolved by a single backwards pass.
+struct RaySegment
+{
+    Ray ray;
+    int pixel;
+    int depth;
+    float throughput; // weight of this segment in the pixel colour
+    int firstChild; // -1 when no reflection rays were traced
+    RayCone cone; // widened to the footprint at the hit, which reflections start from
+
+    // closest hit when the ray was already traced as part of a packet
+    bool traced;
+    float hitT;
+    int object;
+    int primitive;
+
+    glm::vec3 point;
+    glm::vec3 normal;
+    float reflectivity; // albedo[2] at the hit, 0 when the segment does not reflect
+    glm::vec3 color; // local shading first, the final segment colour after resolving
+};
+
+// Per-worker scratch space reused between batches
+struct TraceContext
+{
+    std::vector<RaySegment> segments;
+    std::vector<int> pixelRays;
+    std::vector<int> reflecting;
+    std::vector<std::pair<uint32_t, int>> order; // sort key and segment of the traversal and shading passes
+    std::vector<std::pair<uint32_t, int>> scratch;
+    std::vector<int> shadingRank; // position of every object in shading order
+
+    RenderStats stats; // only touched by the worker that owns the context
+    ShadowCache shadowCache;
+    std::vector<uint32_t> pixelCost; // intersection work per pixel of the last batch
+    std::vector<HitRecord> primaryHits; // closest hit of every primary ray of the last batch, t is kInfinity for misses
+    std::vector<uint64_t> pixelObjects; // ObjectBit of everything the rays of a pixel hit
+};
+
+static const int kGlossyRays = 7;
+// normal perturbations of the fuzzy reflection, summed in this order
+static const float kGlossyOffsets[kGlossyRays] = { 0.0f, 0.01f, 0.02f, -0.01f, -0.02f, 0.001f, -0.001f };
+
+// Closest hit of the segment's ray, from its packet when it was traced as part of one.
+// Segments past the last bounce find nothing.
+bool FindHit(const RaySegment& segment, const Scene& scene, const RenderSettings& settings, HitRecord& hit,
+    RenderStats* stats = nullptr)
+{
+    hit.t = kInfinity;
+    hit.object = -1;
+    if (segment.depth > settings.maxDepth)
+        return false;
+    if (stats)
+        (segment.depth == 0 ? stats->primaryRays : stats->reflectionRays)++;
+    if (segment.traced)
+    {
+        hit.t = segment.hitT;
+        hit.object = segment.object;
+        hit.primitive = segment.primitive;
+        return ResolveHit(segment.ray, scene, hit, segment.cone, settings.textureFilter, stats);
+    }
+    return SceneIntersect(segment.ray, scene, hit, segment.cone, settings.textureFilter, stats);
+}
+
+// Stores the local shading of the segment's hit (the background if nothing was found) and
+// returns true if it reflects
+bool ShadeHit(RaySegment& segment, const HitRecord& hit, bool found, const Scene& scene, const RenderSettings& settings,
+    Sampler& sampler, RenderStats* stats = nullptr, ShadowCache* shadowCache = nullptr)
+{
+    segment.reflectivity = 0;
+    if (!found)
+    {
+        segment.color = kDefaultBackgroundColor;
+        return false;
+    }
+    // reflections keep the spread, curvature of the reflector is ignored
+    segment.cone.width = segment.cone.at(hit.t);
+
+    const Material& material = *hit.material;
+    if (scene.emissive(hit.object))
+    {
+        segment.color = hit.color;
+        return false;
+    }
+
+    float diffuse = 0, specular = 0, back = 0;
+    Lighting(scene, settings, hit.normal, hit.point, -segment.ray.direction, material.specularExponent,
+        diffuse, specular, back, sampler, stats, shadowCache);
+    segment.color = hit.color * back + hit.color * diffuse * material.albedo[0] +
+        glm::vec3(0.7f, 0.7f, 0.0f) * specular * material.albedo[1];
+
+    segment.point = hit.point;
+    segment.normal = hit.normal;
+    segment.reflectivity = material.albedo[2];
+    return segment.reflectivity > 0.0f;
+}
+
+// Hits the segment's ray, stores the local shading and returns true if it reflects
+bool ShadeSegment(RaySegment& segment, const Scene& scene, const RenderSettings& settings, Sampler& sampler,
+    RenderStats* stats = nullptr, ShadowCache* shadowCache = nullptr)
+{
+    HitRecord hit;
+    bool found = FindHit(segment, scene, settings, hit, stats);
+    return ShadeHit(segment, hit, found, scene, settings, sampler, stats, shadowCache);
+}
+
+void SpawnReflections(std::vector<RaySegment>& segments, int parent)
+{
+    // copy the parent, the pushes below may reallocate the vector
+    RaySegment p = segments[parent];
+    segments[parent].firstChild = int(segments.size());
+
+    glm::vec3 reflectOrigin = p.point + p.normal * 1e-2f;
+    RaySegment child = p;
+    child.depth = p.depth + 1;
+    child.throughput = p.throughput * p.reflectivity / kGlossyRays;
+    child.firstChild = -1;
+    child.traced = false;
+    for (int k = 0; k < kGlossyRays; k++)
+    {
+        glm::vec3 n = k == 0 ? p.normal : glm::normalize(p.normal + glm::vec3(kGlossyOffsets[k]));
+        child.ray = Ray(reflectOrigin, glm::normalize(-reflect(p.ray.direction, n)));
+        segments.push_back(child);
+    }
+}
+
+// 6 bits of v spread to every third bit
+static inline uint32_t SpreadBits(uint32_t v)
+{
+    v = (v | (v << 8)) & 0x0000F00F;
+    v = (v | (v << 4)) & 0x000C30C3;
+    return (v | (v << 2)) & 0x00049249;
+}
+
+// Stable LSD radix sort of (key, segment) pairs on the low bits of the key, 8 bits per pass
+void RadixSort(std::vector<std::pair<uint32_t, int>>& items, std::vector<std::pair<uint32_t, int>>& scratch, int bits)
+{
+    scratch.resize(items.size());
+    for (int shift = 0; shift < bits; shift += 8)
+    {
+        size_t offsets[257] = {};
+        for (auto& item : items)
+            offsets[((item.first >> shift) & 255) + 1]++;
+        for (int d = 0; d < 256; d++)
+            offsets[d + 1] += offsets[d];
+        for (auto& item : items)
+            scratch[offsets[(item.first >> shift) & 255]++] = item;
+        items.swap(scratch);
+    }
+}
+
+// Segments[first, last) that still need a closest hit, ordered by the Morton code of their
+// origin on a 64^3 grid over the origins and then by the octant of their direction, so rays
+// that walk the same BVH nodes are traced one after another
+void SortRays(const std::vector<RaySegment>& segments, size_t first, size_t last, const RenderSettings& settings,
+    TraceContext& context)
+{
+    std::vector<std::pair<uint32_t, int>>& order = context.order;
+    order.clear();
+    AABB origins;
+    for (size_t i = first; i < last; i++)
+        if (!segments[i].traced && segments[i].depth <= settings.maxDepth)
+        {
+            order.push_back(std::make_pair(0u, int(i)));
+            origins.grow(segments[i].ray.origin);
+        }
+    if (!settings.sortBatches || order.size() < 2)
+        return;
+
+    glm::vec3 extent = origins.max - origins.min;
+    glm::vec3 scale(0.0f);
+    for (int a = 0; a < 3; a++)
+        if (extent[a] > 0)
+            scale[a] = 63.0f / extent[a];
+    for (auto& entry : order)
+    {
+        const Ray& ray = segments[entry.second].ray;
+        glm::vec3 cell = (ray.origin - origins.min) * scale;
+        uint32_t morton = SpreadBits(uint32_t(cell.x)) | SpreadBits(uint32_t(cell.y)) << 1 | SpreadBits(uint32_t(cell.z)) << 2;
+        uint32_t octant = (ray.direction.x < 0 ? 1 : 0) | (ray.direction.y < 0 ? 2 : 0) | (ray.direction.z < 0 ? 4 : 0);
+        entry.first = morton << 3 | octant;
+    }
+    RadixSort(order, context.scratch, 21);
+}
+
+// Segments[first, last) in shading order: grouped by colour texture, normal map and object, so
+// a group reads the same texels and material. Misses come first.
+void SortHits(const std::vector<RaySegment>& segments, size_t first, size_t last, const Scene& scene,
+    const RenderSettings& settings, const HitRecord* primaryHits, TraceContext& context)
+{
+    // rank of every object in (texture, normal map, object) order, made once per context
+    std::vector<int>& rank = context.shadingRank;
+    if (settings.sortBatches && rank.size() != size_t(scene.objectCount()))
+    {
+        std::vector<int> objects(scene.objectCount());
+        std::iota(objects.begin(), objects.end(), 0);
+        auto key = [&](int object)
+        {
+            const Material& material = scene.material(object);
+            return std::make_tuple(material.image, material.normalMap, object);
+        };
+        std::sort(objects.begin(), objects.end(), [&](int a, int b) { return key(a) < key(b); });
+        rank.resize(objects.size());
+        for (size_t k = 0; k < objects.size(); k++)
+            rank[objects[k]] = int(k) + 1;
+    }
+
+    std::vector<std::pair<uint32_t, int>>& order = context.order;
+    order.clear();
+    for (size_t i = first; i < last; i++)
+    {
+        const RaySegment& segment = segments[i];
+        int object = segment.depth == 0 && primaryHits ? primaryHits[segment.pixel].object : segment.traced ? segment.object : -1;
+        order.push_back(std::make_pair(settings.sortBatches && object >= 0 ? uint32_t(rank[object]) : 0u, int(i)));
+    }
+    if (settings.sortBatches && order.size() > 1)
+    {
+        int bits = 0;
+        while (bits < 32 && (uint64_t(1) << bits) <= rank.size())
+            bits += 8;
+        RadixSort(order, context.scratch, bits);
+    }
+}
+
+// Traces one primary ray per pixel without recursion. The reflection tree is expanded
+// one bounce depth at a time over the whole batch, a wavefront per depth: its rays are first
+// traced in origin and direction order, then the hits are shaded grouped by material
+// (settings.sortBatches). Once a pixel reaches
+// settings.maxRaysPerPixel, the remaining reflections with the lowest throughput
+// see the background, as if they had gone past the maximum depth.
+// When primaryHits is given (a G-buffer of an earlier frame), the primary rays are not traced
+// and only shading, shadow rays and reflections are redone.
+void TraceBatch(const Scene& scene, const RenderSettings& settings, const std::vector<Ray>& rays,
+    glm::vec3* colors, TraceContext& context, const HitRecord* primaryHits = nullptr)
+{
+    std::vector<RaySegment>& segments = context.segments;
+    segments.clear();
+    context.pixelRays.assign(rays.size(), 1);
+    context.pixelCost.assign(rays.size(), 0);
+    context.primaryHits.resize(rays.size());
+    context.pixelObjects.assign(rays.size(), 0);
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        RaySegment segment = RaySegment();
+        segment.ray = rays[i];
+        segment.pixel = i;
+        segment.depth = 0;
+        segment.throughput = 1.0f;
+        segment.firstChild = -1;
+        segment.cone = RayCone(0.0f, settings.pixelAngle());
+        segments.push_back(segment);
+    }
+
+    // primary rays of neighbouring pixels are coherent: find their closest objects a packet at a time
+    for (int first = 0; !primaryHits && settings.packetSize > 1 && settings.maxDepth >= 0 && first < int(rays.size());
+        first += settings.packetSize)
+    {
+        int count = std::min(settings.packetSize, int(rays.size()) - first);
+        RayPacket packet;
+        for (int k = 0; k < count; k++)
+            packet.add(rays[first + k], kInfinity);
+        packet.finish();
+
+        int index[kMaxPacketSize], primitive[kMaxPacketSize];
+        uint64_t cost = context.stats.cost();
+        PacketClosestHit(scene.bvh, scene.sphereStore, scene.shapeStore, packet, index, primitive, &context.stats.traversal);
+        uint32_t share = uint32_t((context.stats.cost() - cost) / count);
+        for (int k = 0; k < count; k++)
+        {
+            RaySegment& segment = segments[first + k];
+            segment.traced = true;
+            segment.hitT = index[k] >= 0 ? packet.tMax[k] : kInfinity;
+            segment.object = index[k];
+            segment.primitive = primitive[k];
+            context.pixelCost[first + k] += share;
+        }
+    }
+
+    size_t levelBegin = 0;
+    while (levelBegin < segments.size())
+    {
+        size_t levelEnd = segments.size();
+
+        // closest hits of the rays that were not traced as packets; G-buffer hits need none
+        if (!(primaryHits && levelBegin == 0))
+        {
+            SortRays(segments, levelBegin, levelEnd, settings, context);
+            for (auto& entry : context.order)
+            {
+                RaySegment& segment = segments[entry.second];
+                uint64_t cost = context.stats.cost();
+                segment.hitT = kInfinity;
+                segment.object = -1;
+                scene.bvh.closestHit(segment.ray, scene.sphereStore, scene.shapeStore, segment.hitT, segment.object,
+                    segment.primitive, &context.stats.traversal);
+                segment.traced = true;
+                context.pixelCost[segment.pixel] += uint32_t(context.stats.cost() - cost);
+            }
+        }
+
+        SortHits(segments, levelBegin, levelEnd, scene, settings, primaryHits, context);
+        for (auto& entry : context.order)
+        {
+            size_t i = entry.second;
+            // light sampling is seeded from the ray, so the image does not depend on the tiling
+            Sampler sampler(Sampler::hash(segments[i].ray.origin, segments[i].ray.direction), 0);
+            RaySegment& segment = segments[i];
+            uint64_t cost = context.stats.cost();
+            HitRecord hit;
+            bool found;
+            if (segment.depth == 0 && primaryHits)
+            {
+                hit = primaryHits[segment.pixel];
+                found = hit.t < kInfinity && settings.maxDepth >= 0;
+            }
+            else
+                found = FindHit(segment, scene, settings, hit, &context.stats);
+            if (!found)
+                hit.t = kInfinity; // also for hits past the far plane
+            if (segment.depth == 0)
+                context.primaryHits[segment.pixel] = hit;
+            if (found)
+                context.pixelObjects[segment.pixel] |= ObjectBit(hit.object);
+
+            ShadeHit(segment, hit, found, scene, settings, sampler, &context.stats, &context.shadowCache);
+            context.pixelCost[segment.pixel] += uint32_t(context.stats.cost() - cost);
+        }
+
+        // in segment order, whatever order they were shaded in
+        context.reflecting.clear();
+        for (size_t i = levelBegin; i < levelEnd; i++)
+            if (segments[i].reflectivity > 0.0f && segments[i].depth < settings.maxDepth)
+                context.reflecting.push_back(int(i));
+
+        // the brightest reflections get the ray budget first
+        std::stable_sort(context.reflecting.begin(), context.reflecting.end(), [&](int a, int b)
+            {
+                return segments[a].throughput > segments[b].throughput;
+            });
+        for (int parent : context.reflecting)
+        {
+            int& used = context.pixelRays[segments[parent].pixel];
+            if (used + kGlossyRays > settings.maxRaysPerPixel)
+                continue;
+            used += kGlossyRays;
+            SpawnReflections(segments, parent);
+        }
+        levelBegin = levelEnd;
+    }
+
+    // children come after their parents, so walking backwards resolves the tree bottom up
+    for (size_t i = segments.size(); i-- > 0;)
+    {
+        RaySegment& segment = segments[i];
+        if (segment.reflectivity > 0.0f)
+        {
+            glm::vec3 reflected(0);
+            for (int k = 0; k < kGlossyRays; k++)
+                reflected = reflected + (segment.firstChild >= 0 ? segments[segment.firstChild + k].color : kDefaultBackgroundColor);
+            segment.color = segment.color + reflected / float(kGlossyRays) * segment.reflectivity;
+        }
+        // linear radiance, only the tone map clamps
+        if (segment.depth == 0)
+            colors[segment.pixel] = segment.color;
+    }
+}
+
+// Monte Carlo estimate for one pixel sample: a single path that picks one direction from
+// the glossy lobe per bounce and may be ended by Russian roulette from settings.rouletteDepth on.
+// The radiance is not clamped per bounce.
+glm::vec3 TracePath(const Ray& primary, const Scene& scene, const RenderSettings& settings, Sampler& sampler,
+    RenderStats* stats = nullptr, ShadowCache* shadowCache = nullptr)
+{
+    RaySegment segment = RaySegment();
+    segment.ray = primary;
+    segment.cone = RayCone(0.0f, settings.pixelAngle());
+    glm::vec3 radiance(0);
+    float throughput = 1.0f;
+
+    for (;;)
+    {
+        bool reflects = ShadeSegment(segment, scene, settings, sampler, stats, shadowCache);
+        radiance += segment.color * throughput;
+        if (!reflects)
+            break;
+
+        throughput *= segment.reflectivity;
+        if (segment.depth >= settings.maxDepth)
+        {
+            // same as the glossy tree: reflections past the last bounce see the background
+            radiance += kDefaultBackgroundColor * throughput;
+            break;
+        }
+
+        if (segment.depth + 1 >= settings.rouletteDepth)
+        {
+            float survive = std::min(1.0f, throughput);
+            if (sampler.next() >= survive)
+                break;
+            throughput /= survive;
+        }
+
+        glm::vec3 n = glm::normalize(segment.normal + sampler.inUnitBall() * settings.glossiness);
+        segment.ray = Ray(segment.point + segment.normal * 1e-2f, glm::normalize(-reflect(segment.ray.direction, n)));
+        segment.depth++;
+    }
+    return radiance;
+}
+
+// Primary ray through the point (i + dx, j + dy) of the image plane
+Ray CameraRay(const RenderSettings& settings, size_t i, size_t j, float dx = 0.5f, float dy = 0.5f)
+{
+    const float fov = settings.fov;
+    float imageAspectRatio = settings.width / (float)settings.height;
+    float Px = (2 * (i + dx) / (float)settings.width - 1) * std::tanf(fov / 2.0f) * imageAspectRatio;
+    float Py = (1 - 2 * (j + double(dy)) / (float)settings.height) * std::tanf(fov / 2.0f);
+    glm::vec3 rayDirection = glm::normalize(glm::vec3(Px, Py, -1));
+    return Ray(glm::vec3(0, 0, 0), rayDirection);
+}
+
+// Path traced pixel colour. With adaptive sampling, samples are taken in batches until the
+// standard error of the mean displayed luminance drops below settings.adaptiveThreshold
+// or settings.samplesPerPixel is reached.
+glm::vec3 SamplePixel(const Scene& scene, const RenderSettings& settings, size_t i, size_t j, long long& samplesTaken,
+    RenderStats* stats = nullptr, ShadowCache* shadowCache = nullptr)
+{
+    glm::vec3 sum(0);
+    double mean = 0, m2 = 0; // running luminance statistics (Welford)
+    int n = 0;
+    int target = settings.adaptive ? std::min(settings.adaptiveMinSamples, settings.samplesPerPixel) : settings.samplesPerPixel;
+
+    while (n < target)
+    {
+        // the stream of a sample only depends on the pixel and the sample number
+        Sampler sampler(i + j * settings.width, n);
+        float dx = sampler.next();
+        float dy = sampler.next();
+        glm::vec3 color = TracePath(CameraRay(settings, i, j, dx, dy), scene, settings, sampler, stats, shadowCache);
+        sum += color;
+        n++;
+
+        glm::vec3 shown = glm::min(color, glm::vec3(1.0f));
+        double luminance = 0.2126 * shown.r + 0.7152 * shown.g + 0.0722 * shown.b;
+        double delta = luminance - mean;
+        mean += delta / n;
+        m2 += delta * (luminance - mean);
+
+        if (n == target && settings.adaptive && n < settings.samplesPerPixel)
+        {
+            double error = std::sqrt(m2 / (n - 1) / n);
+            if (error > settings.adaptiveThreshold)
+                target = std::min(settings.samplesPerPixel, n + settings.adaptiveMinSamples);
+        }
+    }
+
+    samplesTaken += n;
+    return sum / float(n);
+}
+
+#endif // !__TRACER__